@@ -0,0 +1,87 @@
+/*
+ * The cost of destroying entities and of World teardown for plain data components, with and
+ * without one non-trivial (String) component per entity.
+ * Usage: myl_bench_destroy [entities = 500000] [pools|archetypes] [string]
+ */
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "ecs.hpp"
+
+namespace {
+constexpr size_t trivialCount = 8;
+
+struct Position {
+    float x;
+    float y;
+};
+
+struct Name {
+    myl::String value;
+};
+
+double since(std::chrono::steady_clock::time_point start)
+{
+    const auto end = std::chrono::steady_clock::now();
+    return std::chrono::duration<double, std::milli>(end - start).count();
+}
+}
+
+int main(int argc, char** argv)
+{
+    const size_t entityCount = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 500000;
+    const auto archetypes = argc > 2 && std::string(argv[2]) == "archetypes";
+    const auto withString = argc > 3 && std::string(argv[3]) == "string";
+
+    // Component ids are global, so this has to be the only World (not the default one)
+    auto world = std::make_unique<myl::World>();
+    world->setStorage(archetypes ? myl::World::Storage::Archetypes : myl::World::Storage::Pools);
+    myl::ComponentMask mask;
+    for (size_t i = 0; i < trivialCount; ++i) {
+        world->registerComponent("Position" + std::to_string(i),
+            myl::StructBuilder()
+                .addField("x", &Position::x)
+                .addField("y", &Position::y)
+                .build());
+        mask += world->getComponentId("Position" + std::to_string(i));
+    }
+    world->registerComponent("Name", myl::StructBuilder().addField("value", &Name::value).build());
+    if (withString)
+        mask += world->getComponentId("Name");
+
+    const auto first = static_cast<uint32_t>(world->newEntities(entityCount, mask));
+    if (withString) {
+        const auto cName = world->getComponentId("Name");
+        for (const auto [id, name] : world->view<Name>(cName))
+            name->value.assign("a name that doesn't fit inline " + std::to_string(getIndex(id)));
+    }
+
+    // A quarter one by one, a quarter in bulk and the other half with the World
+    const auto quarter = static_cast<uint32_t>(entityCount / 4);
+    auto start = std::chrono::steady_clock::now();
+    for (uint32_t i = 0; i < quarter; ++i)
+        world->destroyEntity(myl::EntityId(first + i));
+    const auto single = since(start);
+
+    std::vector<myl::EntityId> ids;
+    for (uint32_t i = quarter; i < 2 * quarter; ++i)
+        ids.push_back(myl::EntityId(first + i));
+    start = std::chrono::steady_clock::now();
+    world->destroyEntities(ids);
+    const auto bulk = since(start);
+
+    start = std::chrono::steady_clock::now();
+    world.reset();
+    const auto teardown = since(start);
+
+    std::printf("%zu entities, %zu trivial components%s (%s)\n", entityCount, trivialCount,
+        withString ? " + String" : "", archetypes ? "archetypes" : "pools");
+    std::printf("destroyEntity:   %8.2f ms for %u\n", single, quarter);
+    std::printf("destroyEntities: %8.2f ms for %u\n", bulk, quarter);
+    std::printf("~World:          %8.2f ms for the rest\n", teardown);
+    return 0;
+}
@@ -0,0 +1,81 @@
+/*
+ * How well World::parallelForEach scales with the number of threads for a movement update over
+ * the built-in Transform component (AoS, in a paged pool).
+ * Usage: myl_bench_parallelforeach [entities = 200000] [iterations = 100] [max threads]
+ */
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+
+#include "components.hpp"
+#include "ecs.hpp"
+
+namespace c = myl::components;
+
+namespace {
+// Heavy enough per entity that the scheduling overhead doesn't dominate
+void update(c::Transform* trafo, float dt)
+{
+    trafo->angle += dt;
+    const auto dir = glm::vec2(std::cos(trafo->angle), std::sin(trafo->angle));
+    trafo->position += dir * trafo->scale * dt;
+}
+
+template <typename Func>
+double measure(size_t iterations, Func&& func)
+{
+    const auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < iterations; ++i)
+        func();
+    const auto end = std::chrono::steady_clock::now();
+    return std::chrono::duration<double, std::milli>(end - start).count() / iterations;
+}
+}
+
+int main(int argc, char** argv)
+{
+    const size_t entityCount = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 200000;
+    const size_t iterations = argc > 2 ? std::strtoul(argv[2], nullptr, 10) : 100;
+    const size_t hardwareThreads = std::max(std::thread::hardware_concurrency(), 1u);
+    const size_t maxThreads = argc > 3 ? std::strtoul(argv[3], nullptr, 10) : hardwareThreads;
+    const auto dt = 1.0f / 60.0f;
+
+    myl::registerComponent("Transform",
+        myl::StructBuilder()
+            .addField("position", &c::Transform::position)
+            .addField("angle", &c::Transform::angle)
+            .addField("scale", &c::Transform::scale)
+            .addField("origin", &c::Transform::origin)
+            .build());
+    const auto cTrafo = myl::getComponentId("Transform");
+
+    myl::newEntities(entityCount, cTrafo);
+    float angle = 0.0f;
+    for (auto [id, trafo] : myl::view<c::Transform>(cTrafo)) {
+        trafo->angle = angle++;
+        trafo->scale = glm::vec2(1.0f);
+    }
+
+    std::printf("%zu entities, %zu iterations, %zu hardware threads\n", entityCount, iterations,
+        hardwareThreads);
+
+    const auto serial = measure(iterations, [&]() {
+        for (auto [id, trafo] : myl::view<c::Transform>(cTrafo))
+            update(trafo, dt);
+    });
+    std::printf("serial view:    %8.3f ms\n", serial);
+
+    // The calling thread takes part too, so n threads are n - 1 workers
+    for (size_t threads = 2; threads <= std::max(maxThreads, size_t(2)); ++threads) {
+        myl::getDefaultWorld().setWorkerCount(threads - 1);
+        const auto time = measure(iterations, [&]() {
+            myl::parallelForEach(myl::view<c::Transform>(cTrafo),
+                [dt](myl::EntityId, c::Transform* trafo) { update(trafo, dt); });
+        });
+        std::printf("%2zu threads:     %8.3f ms (%.2fx)\n", threads, time, serial / time);
+    }
+    return 0;
+}
@@ -0,0 +1,88 @@
+/*
+ * What wider component masks (MYL_MAX_COMPONENTS) cost in query scans. CMake builds this once
+ * for every width (myl_bench_querymask_64, _128, _256), so run them one after another and
+ * compare. Only 60 components are registered, like in a schema that just outgrew 64.
+ * Component ids are global, so there is only one World and the storage is an argument.
+ * Usage: myl_bench_querymask_<bits> [entities = 100000] [iterations = 50] [pools|archetypes]
+ */
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "ecs.hpp"
+
+namespace {
+constexpr size_t componentCount = 60;
+constexpr size_t componentsPerEntity = 8;
+
+template <typename Func>
+double measure(size_t iterations, Func&& func)
+{
+    const auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < iterations; ++i)
+        func();
+    const auto end = std::chrono::steady_clock::now();
+    return std::chrono::duration<double, std::milli>(end - start).count() / iterations;
+}
+
+myl::ComponentMask randomMask(std::mt19937& rng)
+{
+    myl::ComponentMask mask;
+    for (size_t i = 0; i < componentsPerEntity; ++i)
+        mask += myl::ComponentId(rng() % componentCount);
+    return mask;
+}
+}
+
+int main(int argc, char** argv)
+{
+    const size_t entityCount = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 100000;
+    const size_t iterations = argc > 2 ? std::strtoul(argv[2], nullptr, 10) : 50;
+    std::printf("MYL_MAX_COMPONENTS = %zu, %zu entities\n", myl::maxComponents, entityCount);
+
+    // The raw mask test, like an archetype or query scan does it for every candidate
+    std::mt19937 rng(1);
+    std::vector<myl::ComponentMask> masks(entityCount);
+    for (auto& mask : masks)
+        mask = randomMask(rng);
+    const auto include = myl::ComponentId(3) + myl::ComponentId(7);
+    const auto exclude = myl::ComponentMask(myl::ComponentId(11));
+    size_t matches = 0;
+    const auto maskTime = measure(iterations, [&]() {
+        for (const auto& mask : masks)
+            matches += mask.includes(include) && mask.includesNot(exclude);
+    });
+    std::printf("mask test:     %8.2f ns/mask (%zu)\n", maskTime * 1e6 / masks.size(), matches);
+
+    auto& world = myl::getDefaultWorld();
+    const auto archetypes = argc > 3 && std::string(argv[3]) == "archetypes";
+    world.setStorage(archetypes ? myl::World::Storage::Archetypes : myl::World::Storage::Pools);
+    for (size_t i = 0; i < componentCount; ++i) {
+        myl::StructBuilder builder;
+        builder.addField(
+            "value", std::make_shared<myl::PrimitiveFieldType>(myl::PrimitiveFieldType::U32));
+        world.registerComponent("C" + std::to_string(i), builder.build());
+    }
+    for (const auto& mask : masks)
+        world.newEntities(1, mask);
+
+    const auto scan = measure(iterations, [&]() {
+        for (const auto id : world.foreachEntity(include)) {
+            (void)id;
+            matches++;
+        }
+    });
+    std::printf("foreachEntity: %8.3f ms (%s)\n", scan, archetypes ? "archetypes" : "pools");
+    // Registering a query tests the masks of all entities
+    const auto registration = measure(iterations, [&]() {
+        const auto query = world.registerQuery(include, exclude);
+        matches += world.getQuerySize(query);
+        world.unregisterQuery(query);
+    });
+    std::printf("registerQuery: %8.3f ms (%zu)\n", registration, matches);
+    return 0;
+}
@@ -5,6 +5,7 @@ local T2 = tweak.getVec2
 local Tc = tweak.getColor
 
 myl.loadComponents("components.toml")
+myl.loadPrefabs("prefabs.toml")
 
 tweak.set("playerSpeed", 500.0)
 
@@ -56,15 +57,13 @@ function myl.main()
     myl.addComponent(entity, myl.c.Name).value:set("Player")
     myl.addComponent(entity, myl.c.Color).value = myl.color.new("#af19bf")
     myl.addComponent(entity, myl.c.PlayerInputState)
+    myl.addComponent(entity, myl.c.Inventory).items:set("coins", 100)
     local circle = myl.addComponent(entity, myl.c.CircleRender)
     circle.radius = 40
     circle.pointCount = 32
 
-    entity = myl.newEntity()
-    addTransform(entity, 200, 200)
-    myl.addComponent(entity, myl.c.Name).value:set("Someting")
-    myl.addComponent(entity, myl.c.Color).value = myl.color.new("#75e5eb")
-    myl.addComponent(entity, myl.c.RectangleRender).size = myl.vec2(120, 120)
+    entity = myl.instantiate("Box")
+    myl.getComponents(entity, myl.c.Transform).position = myl.vec2(200, 200)
 
     window.init("myl", resX, resY, false)
     --window.setVSync(true)
@@ -78,6 +77,8 @@ function myl.main()
             myl.setSystemEnabled("_Debug", debug)
         end
 
+        -- invokeSystem doesn't advance the tick (invokeSystems does), so do it once per frame
+        myl.advanceTick()
         myl.invokeSystem("PlayerInput", dt)
         myl.invokeSystem("PlayerMovement", dt)
         myl.invokeSystem("SetColor", dt)
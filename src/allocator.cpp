@@ -0,0 +1,210 @@
+#include "allocator.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <cstdlib>
+
+namespace myl {
+
+namespace {
+    Allocator& getDefaultFieldAllocator()
+    {
+        // Leaked on purpose, see getFieldAllocator
+        static auto allocator = new SlabAllocator(getMallocAllocator(), false);
+        return *allocator;
+    }
+
+    std::atomic<Allocator*>& getFieldAllocatorPtr()
+    {
+        static std::atomic<Allocator*> allocator { &getDefaultFieldAllocator() };
+        return allocator;
+    }
+}
+
+void* MallocAllocator::allocate(size_t size)
+{
+    const auto ptr = std::malloc(size);
+    assert(ptr);
+    return ptr;
+}
+
+void MallocAllocator::deallocate(void* ptr, size_t /*size*/)
+{
+    std::free(ptr);
+}
+
+SlabAllocator::SlabAllocator(Allocator& fallback, bool releasable)
+    : fallback_(fallback)
+    , owner_(std::this_thread::get_id())
+    , releasable_(releasable)
+{
+}
+
+SlabAllocator::~SlabAllocator()
+{
+    // Others are meant to live forever, they don't know what they passed on to the fallback
+    if (releasable_)
+        release();
+}
+
+size_t SlabAllocator::getClass(size_t size)
+{
+    size_t cls = 0;
+    while ((minClassSize << cls) < size)
+        ++cls;
+    return cls;
+}
+
+bool SlabAllocator::isOwner() const
+{
+    return std::this_thread::get_id() == owner_;
+}
+
+uint8_t* SlabAllocator::allocateSlab()
+{
+    if (freeSlabs_.empty()) {
+        // One extra slab is needed to align them, so get a few at once to waste less
+        const auto raw = fallback_.allocate(batchAllocSize);
+        slabAllocations_.push_back(raw);
+        const auto addr = reinterpret_cast<uintptr_t>(raw);
+        const auto aligned = (addr + slabSize - 1) & ~(uintptr_t(slabSize) - 1);
+        for (size_t i = slabBatchSize; i > 0; --i)
+            freeSlabs_.push_back(aligned + (i - 1) * slabSize);
+
+        const auto current = batches_.load(std::memory_order_relaxed);
+        auto batches = current ? std::make_unique<Batches>(*current) : std::make_unique<Batches>();
+        batches->insert(std::upper_bound(batches->begin(), batches->end(), aligned), aligned);
+        batches_.store(batches.get(), std::memory_order_release);
+        batchVersions_.push_back(std::move(batches));
+    }
+    const auto slab = freeSlabs_.back();
+    freeSlabs_.pop_back();
+    slabCount_++;
+    return reinterpret_cast<uint8_t*>(slab);
+}
+
+bool SlabAllocator::ownsSlab(void* ptr) const
+{
+    const auto batches = batches_.load(std::memory_order_acquire);
+    if (!batches)
+        return false;
+    const auto addr = reinterpret_cast<uintptr_t>(ptr);
+    const auto it = std::upper_bound(batches->begin(), batches->end(), addr);
+    return it != batches->begin() && addr - *(it - 1) < slabBatchSize * slabSize;
+}
+
+void SlabAllocator::pushFree(void* ptr, size_t size)
+{
+    auto& sizeClass = classes_[getClass(size)];
+    const auto block = reinterpret_cast<FreeBlock*>(ptr);
+    block->next = sizeClass.freeList;
+    sizeClass.freeList = block;
+}
+
+void SlabAllocator::collectRemoteFrees()
+{
+    auto block = remoteFrees_.exchange(nullptr, std::memory_order_acquire);
+    while (block) {
+        const auto next = block->next;
+        pushFree(block, block->size);
+        block = next;
+    }
+}
+
+void* SlabAllocator::allocate(size_t size)
+{
+    if (size > maxClassSize || !isOwner()) {
+        const auto ptr = fallback_.allocate(size);
+        if (releasable_) {
+            std::lock_guard<std::mutex> lock(mutex_);
+            large_.emplace(ptr, size);
+        }
+        return ptr;
+    }
+
+    if (remoteFrees_.load(std::memory_order_relaxed))
+        collectRemoteFrees();
+    const auto cls = getClass(size);
+    const auto blockSize = minClassSize << cls;
+    auto& sizeClass = classes_[cls];
+    if (sizeClass.freeList) {
+        const auto block = sizeClass.freeList;
+        sizeClass.freeList = block->next;
+        return block;
+    }
+    if (sizeClass.cursor == sizeClass.end) {
+        sizeClass.cursor = allocateSlab();
+        sizeClass.end = sizeClass.cursor + slabSize;
+    }
+    const auto ptr = sizeClass.cursor;
+    sizeClass.cursor += blockSize;
+    return ptr;
+}
+
+void SlabAllocator::deallocate(void* ptr, size_t size)
+{
+    if (!ptr)
+        return;
+    if (size <= maxClassSize && ownsSlab(ptr)) {
+        if (isOwner()) {
+            pushFree(ptr, size);
+            return;
+        }
+        // Only the owner may touch the free lists, it collects these in allocate
+        const auto block = reinterpret_cast<RemoteBlock*>(ptr);
+        block->size = size;
+        block->next = remoteFrees_.load(std::memory_order_relaxed);
+        while (!remoteFrees_.compare_exchange_weak(
+            block->next, block, std::memory_order_release, std::memory_order_relaxed)) {
+        }
+        return;
+    }
+
+    if (releasable_) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        large_.erase(ptr);
+    }
+    fallback_.deallocate(ptr, size);
+}
+
+void SlabAllocator::release()
+{
+    assert(isOwner() && releasable_);
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (const auto ptr : slabAllocations_)
+        fallback_.deallocate(ptr, batchAllocSize);
+    for (const auto [ptr, size] : large_)
+        fallback_.deallocate(ptr, size);
+    slabAllocations_.clear();
+    freeSlabs_.clear();
+    batches_.store(nullptr, std::memory_order_relaxed);
+    batchVersions_.clear();
+    remoteFrees_.store(nullptr, std::memory_order_relaxed);
+    large_.clear();
+    slabCount_ = 0;
+    classes_ = {};
+}
+
+size_t SlabAllocator::getSlabCount() const
+{
+    return slabCount_;
+}
+
+Allocator& getMallocAllocator()
+{
+    static MallocAllocator allocator;
+    return allocator;
+}
+
+Allocator& getFieldAllocator()
+{
+    return *getFieldAllocatorPtr().load(std::memory_order_relaxed);
+}
+
+Allocator* setFieldAllocator(Allocator* allocator)
+{
+    return getFieldAllocatorPtr().exchange(allocator ? allocator : &getDefaultFieldAllocator());
+}
+
+}
@@ -0,0 +1,135 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace myl {
+
+/*
+ * The heap storage of String and Vector (and strings set from Lua) comes from
+ * getFieldAllocator(). Deallocation is sized, so allocators don't need any headers.
+ */
+class Allocator {
+public:
+    virtual ~Allocator() = default;
+
+    virtual void* allocate(size_t size) = 0;
+    // size is the same that was passed to allocate
+    virtual void deallocate(void* ptr, size_t size) = 0;
+};
+
+class MallocAllocator : public Allocator {
+public:
+    void* allocate(size_t size) override;
+    void deallocate(void* ptr, size_t size) override;
+};
+
+/*
+ * Small allocations (up to maxClassSize) are served from 64KB slabs with a free list per
+ * power-of-two size class, so thousands of small strings and vectors don't fragment the heap and
+ * freeing them is just a push onto a free list. Everything else goes to the fallback.
+ * Pointers that were not allocated here are passed on to the fallback too, so a slab can be
+ * installed with setFieldAllocator while strings from the previous allocator are still alive.
+ * The slabs belong to the thread that created the allocator, which uses them without a lock.
+ * Other threads allocate from the fallback, and their frees of slab blocks go onto a lock-free
+ * list, which the owner picks up on its next allocation.
+ * Only releasable allocators (arenas) keep track of what went to the fallback, which takes a
+ * lock. The others can't release anything, so they don't need to know.
+ */
+class SlabAllocator : public Allocator {
+public:
+    static constexpr size_t minClassSize = 16;
+    static constexpr size_t maxClassSize = 2048;
+    static constexpr size_t slabSize = 64 * 1024;
+
+    explicit SlabAllocator(Allocator& fallback, bool releasable = true);
+    ~SlabAllocator();
+
+    SlabAllocator(const SlabAllocator&) = delete;
+    SlabAllocator& operator=(const SlabAllocator&) = delete;
+
+    void* allocate(size_t size) override;
+    void deallocate(void* ptr, size_t size) override;
+
+    /*
+     * Frees all memory at once, including the large allocations that went to the fallback.
+     * Everything that was allocated from here must not be used (or freed) anymore, so this is
+     * for dropping a whole level (see World::destroyAllEntities) without freeing every string.
+     * Only the owner thread may call this and only if the allocator is releasable.
+     */
+    void release();
+
+    // Only the owner thread may call this
+    size_t getSlabCount() const;
+
+private:
+    static constexpr size_t classCount = 8; // 16, 32, .., 2048
+    static constexpr size_t slabBatchSize = 16;
+    static constexpr size_t batchAllocSize = (slabBatchSize + 1) * slabSize;
+
+    struct FreeBlock {
+        FreeBlock* next;
+    };
+
+    // A block freed by another thread
+    struct RemoteBlock {
+        RemoteBlock* next;
+        size_t size;
+    };
+    static_assert(sizeof(RemoteBlock) <= minClassSize);
+
+    struct SizeClass {
+        FreeBlock* freeList = nullptr;
+        // The rest of the most recent slab, which hasn't been handed out yet
+        uint8_t* cursor = nullptr;
+        uint8_t* end = nullptr;
+    };
+
+    static size_t getClass(size_t size);
+
+    bool isOwner() const;
+    uint8_t* allocateSlab();
+    bool ownsSlab(void* ptr) const;
+    void pushFree(void* ptr, size_t size);
+    void collectRemoteFrees();
+
+    Allocator& fallback_;
+    const std::thread::id owner_;
+    const bool releasable_;
+    std::array<SizeClass, classCount> classes_;
+    size_t slabCount_ = 0;
+    // Aligned slabs that don't belong to a size class yet
+    std::vector<uintptr_t> freeSlabs_;
+    // What was actually allocated for the slabs (batchAllocSize each)
+    std::vector<void*> slabAllocations_;
+    /*
+     * The (aligned) start of every batch of slabs, sorted, so any thread can find out whether
+     * a pointer belongs to a slab. The owner publishes a new copy for every batch (once per
+     * MB) and keeps the old ones, because other threads might still be reading them.
+     */
+    using Batches = std::vector<uintptr_t>;
+    std::atomic<const Batches*> batches_ { nullptr };
+    std::vector<std::unique_ptr<Batches>> batchVersions_;
+    // Slab blocks freed by other threads
+    std::atomic<RemoteBlock*> remoteFrees_ { nullptr };
+    // Allocations that went to the fallback (too large or not from the owner), only if releasable
+    std::mutex mutex_;
+    std::unordered_map<void*, size_t> large_;
+};
+
+Allocator& getMallocAllocator();
+
+// A process-wide SlabAllocator, unless something else was installed with setFieldAllocator.
+// It is never destroyed, so strings in static objects can still be freed at exit.
+Allocator& getFieldAllocator();
+// Returns the previous allocator. nullptr installs the default one.
+Allocator* setFieldAllocator(Allocator* allocator);
+
+}
@@ -0,0 +1,173 @@
+#include "atom.hpp"
+
+#include <array>
+#include <atomic>
+#include <cassert>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+namespace myl {
+
+namespace {
+    /* Interning takes a lock, but lookups don't: the views live in chunks that never move, so
+     * they stay valid while other threads add atoms. An id has to get to another thread somehow
+     * (a component, a command buffer, ..), and that already synchronizes.
+     */
+    class AtomTable {
+    public:
+        AtomTable()
+        {
+            [[maybe_unused]] const auto empty = intern(std::string_view());
+            assert(empty == 0);
+        }
+
+        uint32_t intern(std::string_view str)
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            const auto it = ids_.find(str);
+            if (it != ids_.end())
+                return it->second;
+
+            const auto id = count_.load(std::memory_order_relaxed);
+            assert(id < chunkSize * maxChunks && "Too many atoms");
+            auto& chunk = chunks_[id >> chunkBits];
+            if (!chunk)
+                chunk = std::make_unique<std::string_view[]>(chunkSize);
+
+            const auto data = allocate(str.size() + 1);
+            if (!str.empty())
+                std::memcpy(data, str.data(), str.size());
+            data[str.size()] = '\0';
+            const auto view = std::string_view(data, str.size());
+            chunk[id & (chunkSize - 1)] = view;
+            ids_.emplace(view, id);
+            count_.store(id + 1, std::memory_order_release);
+            return id;
+        }
+
+        bool contains(uint32_t id) const
+        {
+            return id < count_.load(std::memory_order_acquire);
+        }
+
+        std::string_view get(uint32_t id) const
+        {
+            assert(contains(id));
+            return chunks_[id >> chunkBits][id & (chunkSize - 1)];
+        }
+
+    private:
+        static constexpr size_t chunkBits = 12;
+        static constexpr size_t chunkSize = size_t(1) << chunkBits;
+        static constexpr size_t maxChunks = 1024;
+        static constexpr size_t blockSize = 64 * 1024;
+
+        // The strings are packed into big blocks, since they are never freed anyway
+        char* allocate(size_t size)
+        {
+            if (size > blockSize) {
+                blocks_.push_back(std::make_unique<char[]>(size));
+                return blocks_.back().get();
+            }
+            if (blockUsed_ + size > blockSize) {
+                blocks_.push_back(std::make_unique<char[]>(blockSize));
+                block_ = blocks_.back().get();
+                blockUsed_ = 0;
+            }
+            const auto ptr = block_ + blockUsed_;
+            blockUsed_ += size;
+            return ptr;
+        }
+
+        std::mutex mutex_;
+        std::unordered_map<std::string_view, uint32_t> ids_;
+        std::array<std::unique_ptr<std::string_view[]>, maxChunks> chunks_;
+        std::atomic<uint32_t> count_ { 0 };
+        std::vector<std::unique_ptr<char[]>> blocks_;
+        char* block_ = nullptr;
+        size_t blockUsed_ = blockSize;
+    };
+
+    AtomTable& getAtomTable()
+    {
+        static AtomTable table;
+        return table;
+    }
+}
+
+Atom::Atom(const char* buf, size_t size)
+    : Atom(std::string_view(buf, size))
+{
+}
+
+Atom::Atom(const char* str)
+    : Atom(std::string_view(str))
+{
+}
+
+Atom::Atom(const std::string& str)
+    : Atom(std::string_view(str))
+{
+}
+
+Atom::Atom(std::string_view str)
+    : id_(str.empty() ? 0 : getAtomTable().intern(str))
+{
+}
+
+Atom Atom::fromId(uint32_t id)
+{
+    assert(isValidId(id));
+    Atom atom;
+    atom.id_ = id;
+    return atom;
+}
+
+bool Atom::isValidId(uint32_t id)
+{
+    return getAtomTable().contains(id);
+}
+
+uint32_t Atom::getId() const
+{
+    return id_;
+}
+
+const char* Atom::getData() const
+{
+    return view().data();
+}
+
+size_t Atom::getSize() const
+{
+    return view().size();
+}
+
+std::string_view Atom::view() const
+{
+    return getAtomTable().get(id_);
+}
+
+std::string Atom::str() const
+{
+    return std::string(view());
+}
+
+Atom::operator std::string() const
+{
+    return str();
+}
+
+bool Atom::operator==(const Atom& other) const
+{
+    return id_ == other.id_;
+}
+
+bool Atom::operator!=(const Atom& other) const
+{
+    return id_ != other.id_;
+}
+}
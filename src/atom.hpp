@@ -0,0 +1,56 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <string_view>
+
+namespace myl {
+
+/* An interned string. Equal strings are interned to the same id (an index into a global table),
+ * so comparing atoms is an integer compare and they are trivially copyable (no init/free/copy).
+ * The strings are never freed, so atoms are meant for a small vocabulary (names, enum-like
+ * values), not arbitrary text - use String for that.
+ * Id 0 is the empty string, so zeroed memory is a valid atom. Lua sees atoms as the MylAtom cdef
+ * (lua/atom.lua), which caches a Lua string per id.
+ */
+class Atom {
+public:
+    Atom() = default;
+    Atom(const char* buf, size_t size);
+    Atom(const char* str);
+    Atom(const std::string& str);
+    Atom(std::string_view str);
+
+    static Atom fromId(uint32_t id);
+    // Whether id has been handed out by an Atom already (fromId asserts this)
+    static bool isValidId(uint32_t id);
+
+    uint32_t getId() const;
+
+    // null-terminated and valid forever
+    const char* getData() const;
+    size_t getSize() const;
+    std::string_view view() const;
+
+    std::string str() const;
+    operator std::string() const;
+
+    bool operator==(const Atom& other) const;
+    bool operator!=(const Atom& other) const;
+
+private:
+    uint32_t id_ = 0;
+};
+
+static_assert(sizeof(Atom) == sizeof(uint32_t));
+
+}
+
+template <>
+struct std::hash<myl::Atom> {
+    size_t operator()(const myl::Atom& atom) const
+    {
+        return std::hash<uint32_t>()(atom.getId());
+    }
+};
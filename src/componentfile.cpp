@@ -16,6 +16,9 @@ struct StructData {
     StructType structType;
     std::string name;
     bool isComponent;
+    ComponentPool::Type poolType;
+    ComponentPool::Options poolOptions;
+    StructBuilder::Packing packing;
 };
 
 struct ComponentFileData {
@@ -49,13 +52,17 @@ std::shared_ptr<FieldType> parseType(const std::string& typeStr, const Component
             const auto arraySize = boost::lexical_cast<size_t>(*bracketType);
             return std::make_shared<ArrayFieldType>(parseType(baseType, cache), arraySize);
         } else {
-            return std::make_shared<MapFieldType>(
-                parseType(*bracketType, cache), parseType(baseType, cache));
+            const auto keyType = parseType(*bracketType, cache);
+            if (!MapFieldType::isValidKeyType(*keyType))
+                return std::make_shared<ErrorFieldType>(typeStr);
+            return std::make_shared<MapFieldType>(keyType, parseType(baseType, cache));
         }
     }
 
     if (typeStr == "string")
         return std::make_shared<StringFieldType>();
+    if (typeStr == "atom")
+        return std::make_shared<AtomFieldType>();
 
     const auto builtinIt = PrimitiveFieldType::typeFromString.find(typeStr);
     if (builtinIt != PrimitiveFieldType::typeFromString.end())
@@ -84,13 +91,24 @@ StructType parseStruct(const toml::array& fields, const ComponentFileData& cache
     return structType;
 }
 
-bool hasErrorType(StructType& structType)
+std::optional<StructBuilder::Packing> parsePacking(const std::string& str)
+{
+    if (str == "none")
+        return StructBuilder::Packing::None;
+    else if (str == "reorder")
+        return StructBuilder::Packing::Reorder;
+    else if (str == "bits")
+        return StructBuilder::Packing::Bits;
+    return std::nullopt;
+}
+
+bool hasType(StructType& structType, FieldType::Type type)
 {
     for (auto& [name, field] : structType.fields) {
         bool has = false;
         traverse(
-            [&has](std::shared_ptr<FieldType>& fieldType) {
-                has = has || fieldType->fieldType == FieldType::Error;
+            [&has, type](std::shared_ptr<FieldType>& fieldType) {
+                has = has || fieldType->fieldType == type;
             },
             field);
         if (has)
@@ -126,17 +144,67 @@ ComponentFileData loadComponents(std::string_view path)
         }
     }
 
+    // packing = "none" | "reorder" | "bits" can be set for the whole file or per struct
+    const std::string filePacking = tbl["packing"].value_or("none");
+
     for (const auto& struct_ : *tbl["structs"].as_array()) {
         const auto& structTable = *struct_.as_table();
         const auto name = structTable["name"].as_string()->get();
 
         auto structType = parseStruct(*structTable["fields"].as_array(), data);
-        if (hasErrorType(structType)) {
+        if (hasType(structType, FieldType::Error)) {
             std::cerr << "Type '" << name << "' includes error types!" << std::endl;
         }
+        // StructFieldType can't be initialized, freed or copied (yet), so don't let it get
+        // anywhere near a pool or a prefab
+        if (hasType(structType, FieldType::Struct)) {
+            std::cerr << "Type '" << name << "' has struct fields, which are not supported"
+                      << std::endl;
+            continue;
+        }
 
         const bool isComponent = structTable["component"].value_or(false);
-        data.structs.insert(name, StructData { structType, name, isComponent });
+
+        auto poolType = ComponentPool::Type::Paged;
+        const std::string pool = structTable["pool"].value_or("paged");
+        if (pool == "sparse")
+            poolType = ComponentPool::Type::Sparse;
+        else if (pool == "virtual")
+            poolType = ComponentPool::Type::Virtual;
+        else if (pool != "paged")
+            std::cerr << "Unknown pool type '" << pool << "' for '" << name << "'" << std::endl;
+
+        ComponentPool::Options poolOptions;
+        poolOptions.capacity = structTable["capacity"].value_or<size_t>(0);
+        // These only do something for pool = "virtual"
+        poolOptions.hugePages = structTable["hugePages"].value_or(false);
+        poolOptions.alignment = structTable["alignment"].value_or<size_t>(1);
+        const auto alignment = poolOptions.alignment;
+        if (alignment == 0 || (alignment & (alignment - 1)) != 0 || alignment > 4096) {
+            std::cerr << "Invalid alignment " << alignment << " for '" << name << "'" << std::endl;
+            poolOptions.alignment = 1;
+        }
+
+        // layout = "soa" stores every field in it's own column, which needs a paged pool
+        const std::string layout = structTable["layout"].value_or("aos");
+        if (layout == "soa") {
+            if (poolType == ComponentPool::Type::Paged)
+                poolType = ComponentPool::Type::Soa;
+            else
+                std::cerr << "layout = 'soa' needs a paged pool ('" << name << "')" << std::endl;
+        } else if (layout != "aos") {
+            std::cerr << "Unknown layout '" << layout << "' for '" << name << "'" << std::endl;
+        }
+
+        const std::string packingStr = structTable["packing"].value_or(filePacking);
+        auto packing = parsePacking(packingStr);
+        if (!packing) {
+            std::cerr << "Unknown packing '" << packingStr << "' for '" << name << "'" << std::endl;
+            packing = StructBuilder::Packing::None;
+        }
+
+        data.structs.insert(name,
+            StructData { structType, name, isComponent, poolType, poolOptions, *packing });
     }
 
     return data;
@@ -150,10 +218,11 @@ void loadComponents(World& world, std::string_view path)
             continue;
 
         StructBuilder sb;
+        sb.setPacking(component.packing);
         for (const auto& [fieldName, fieldType] : component.structType.fields) {
             sb.addField(fieldName, fieldType);
         }
-        world.registerComponent(name, sb.build());
+        world.registerComponent(name, sb.build(), component.poolType, component.poolOptions);
     }
 }
 
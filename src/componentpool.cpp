@@ -0,0 +1,743 @@
+#include "componentpool.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+
+#include "util.hpp"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#endif
+
+namespace myl {
+
+namespace {
+    constexpr size_t commitChunkSize = 64 * 1024;
+    constexpr size_t hugePageSize = 2 * 1024 * 1024;
+
+    // Returns nullptr if the address space could not be reserved
+    void* reserveMemory(size_t size)
+    {
+#ifdef _WIN32
+        return VirtualAlloc(nullptr, size, MEM_RESERVE, PAGE_NOACCESS);
+#else
+        const auto ptr = mmap(nullptr, size, PROT_NONE,
+            MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        return ptr == MAP_FAILED ? nullptr : ptr;
+#endif
+    }
+
+    // Committed memory is zeroed
+    bool commitMemory(void* ptr, size_t size, bool hugePages)
+    {
+#ifdef _WIN32
+        // Large pages on Windows need a special privilege and can't be committed partially
+        (void)hugePages;
+        return VirtualAlloc(ptr, size, MEM_COMMIT, PAGE_READWRITE) != nullptr;
+#else
+        if (mprotect(ptr, size, PROT_READ | PROT_WRITE) != 0)
+            return false;
+#ifdef MADV_HUGEPAGE
+        // This is only a hint, so it doesn't matter if it fails
+        if (hugePages)
+            madvise(ptr, size, MADV_HUGEPAGE);
+#else
+        (void)hugePages;
+#endif
+        return true;
+#endif
+    }
+
+    // Gives the memory back to the OS, but keeps the address space reserved
+    void decommitMemory(void* ptr, size_t size)
+    {
+#ifdef _WIN32
+        VirtualFree(ptr, size, MEM_DECOMMIT);
+#else
+        // Replaces the pages with fresh inaccessible ones
+        mmap(ptr, size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_FIXED, -1,
+            0);
+#endif
+    }
+
+    void releaseMemory(void* ptr, size_t size)
+    {
+#ifdef _WIN32
+        (void)size;
+        VirtualFree(ptr, 0, MEM_RELEASE);
+#else
+        munmap(ptr, size);
+#endif
+    }
+
+    size_t alignUp(size_t value, size_t alignment)
+    {
+        return (value + alignment - 1) / alignment * alignment;
+    }
+}
+
+std::unique_ptr<ComponentPool> ComponentPool::create(
+    Type type, size_t componentSize, const Options& options)
+{
+    std::unique_ptr<ComponentPool> pool;
+    switch (type) {
+    case Type::Paged:
+        pool = std::make_unique<PagedComponentPool>(componentSize);
+        break;
+    case Type::Sparse:
+        pool = std::make_unique<SparseComponentPool>(componentSize);
+        break;
+    case Type::Soa:
+        assert(!options.columnSizes.empty());
+        pool = std::make_unique<PagedComponentPool>(componentSize, 0, options.columnSizes);
+        break;
+    case Type::Virtual:
+        pool = std::make_unique<VirtualComponentPool>(
+            componentSize, options.alignment, options.hugePages);
+        break;
+    default:
+        assert(false && "Invalid ComponentPool::Type");
+        return nullptr;
+    }
+    if (options.capacity > 0)
+        pool->reserve(options.capacity);
+    return pool;
+}
+
+void ComponentPool::reserve(size_t /*capacity*/)
+{
+}
+
+bool ComponentPool::hasColumns() const
+{
+    return false;
+}
+
+void* ComponentPool::getColumn(EntityId /*entityId*/, size_t /*column*/, size_t& count)
+{
+    assert(false && "Pool has no columns");
+    count = 0;
+    return nullptr;
+}
+
+PagedComponentPool::PagedComponentPool(
+    size_t componentSize, size_t pageSize, const std::vector<size_t>& columnSizes)
+    : componentSize_(componentSize)
+    , pageSize_(pageSize)
+{
+    if (pageSize_ == 0)
+        pageSize_ = 1024 / componentSize; // ~1KB per page
+
+    if (!columnSizes.empty()) {
+        // Every column starts at pageSize * (sum of the previous sizes), so if pageSize is
+        // a multiple of 16, every column is aligned for anything (including SIMD loads).
+        pageSize_ = std::max<size_t>(16, pageSize_ / 16 * 16);
+        size_t offset = 0;
+        for (const auto size : columnSizes) {
+            columns_.push_back(Column { offset * pageSize_, size });
+            offset += size;
+        }
+        assert(offset <= componentSize_);
+    }
+}
+
+bool PagedComponentPool::has(EntityId entityId) const
+{
+    const auto [page, index] = getIndices(entityId);
+    return pages_.size() > page && (pages_[page].occupied[index / 64] & (1ull << (index % 64)));
+}
+
+void* PagedComponentPool::add(EntityId entityId)
+{
+    assert(!has(entityId));
+    const auto [page, index] = getIndices(entityId);
+    if (page >= pages_.size())
+        addPages(page + 1 - pages_.size());
+    allocatePage(page);
+
+    auto& pageObj = pages_[page];
+    pageObj.occupied[index / 64] |= 1ull << (index % 64);
+    pageObj.count++;
+    pageObj.ticks[index] = 0;
+    size_++;
+
+    clearSlots(page, index, 1);
+    return columns_.empty() ? getPointer(page, index) : nullptr;
+}
+
+void* PagedComponentPool::get(EntityId entityId)
+{
+    assert(has(entityId));
+    if (!columns_.empty())
+        return nullptr;
+    const auto [page, index] = getIndices(entityId);
+    return getPointer(page, index);
+}
+
+void PagedComponentPool::remove(EntityId entityId)
+{
+    assert(has(entityId));
+    const auto [page, index] = getIndices(entityId);
+    auto& pageObj = pages_[page];
+    pageObj.occupied[index / 64] &= ~(1ull << (index % 64));
+    pageObj.count--;
+    size_--;
+
+    if (pageObj.count == 0) {
+        pageObj.data.reset();
+        pageObj.ticks.reset();
+        nonEmptyPages_[page / 64] &= ~(1ull << (page % 64));
+    }
+}
+
+void PagedComponentPool::reserve(size_t capacity)
+{
+    const auto pageCount = (capacity + pageSize_ - 1) / pageSize_;
+    if (pageCount > pages_.size())
+        addPages(pageCount - pages_.size());
+}
+
+void PagedComponentPool::addRange(EntityId first, size_t count, uint32_t tick)
+{
+    if (count == 0)
+        return;
+    const auto begin = getIndex(first);
+    const auto end = begin + count;
+    const auto lastPage = (end - 1) / pageSize_;
+    if (lastPage >= pages_.size())
+        addPages(lastPage + 1 - pages_.size());
+
+    size_t id = begin;
+    while (id < end) {
+        const auto [page, index] = getIndices(EntityId(id));
+        const auto n = std::min(end - id, pageSize_ - index);
+        allocatePage(page);
+        auto& pageObj = pages_[page];
+        // Set the occupied bits a word at a time
+        for (size_t i = index; i < index + n;) {
+            const auto bit = i % 64;
+            const auto len = std::min(64 - bit, index + n - i);
+            const auto mask = (len == 64 ? ~0ull : (1ull << len) - 1) << bit;
+            assert(!(pageObj.occupied[i / 64] & mask));
+            pageObj.occupied[i / 64] |= mask;
+            i += len;
+        }
+        pageObj.count += n;
+        clearSlots(page, index, n);
+        std::fill(pageObj.ticks.get() + index, pageObj.ticks.get() + index + n, tick);
+        pageTicks_[page] = std::max(pageTicks_[page].load(std::memory_order_relaxed), tick);
+        id += n;
+    }
+    size_ += count;
+}
+
+void PagedComponentPool::clear()
+{
+    pages_.clear();
+    nonEmptyPages_.clear();
+    pageTicks_ = std::vector<std::atomic<uint32_t>>();
+    size_ = 0;
+}
+
+bool PagedComponentPool::hasColumns() const
+{
+    return !columns_.empty();
+}
+
+void* PagedComponentPool::getColumn(EntityId entityId, size_t column, size_t& count)
+{
+    assert(column < columns_.size());
+    assert(has(entityId));
+    const auto [page, index] = getIndices(entityId);
+    const auto& col = columns_[column];
+    count = pageSize_ - index;
+    return reinterpret_cast<uint8_t*>(pages_[page].data.get()) + col.offset + index * col.size;
+}
+
+size_t PagedComponentPool::getSize() const
+{
+    return size_;
+}
+
+bool PagedComponentPool::getNext(size_t& cursor, EntityId& entityId, size_t end) const
+{
+    auto [page, index] = getIndices(EntityId(cursor));
+    while ((page = findNonEmptyPage(page)) < pages_.size() && page * pageSize_ < end) {
+        // If we skipped pages, we start at the beginning of the page
+        if (page != cursor / pageSize_)
+            index = 0;
+        const auto& occupied = pages_[page].occupied;
+        for (size_t w = index / 64; w < occupied.size(); ++w) {
+            auto word = occupied[w];
+            // Mask out the bits before index in the first word
+            if (w == index / 64)
+                word &= ~0ull << (index % 64);
+            if (word) {
+                const auto id = page * pageSize_ + w * 64 + countTrailingZeros(word);
+                if (id >= end)
+                    break;
+                entityId = EntityId(id);
+                cursor = id + 1;
+                return true;
+            }
+        }
+        page++;
+        index = 0;
+    }
+    cursor = std::max(cursor, std::min(end, pages_.size() * pageSize_));
+    return false;
+}
+
+void PagedComponentPool::setChanged(EntityId entityId, uint32_t tick)
+{
+    assert(has(entityId));
+    const auto [page, index] = getIndices(entityId);
+    pages_[page].ticks[index] = tick;
+    // Ticks only go up, but we might still race with an older tick
+    auto& pageTick = pageTicks_[page];
+    auto current = pageTick.load(std::memory_order_relaxed);
+    while (current < tick
+        && !pageTick.compare_exchange_weak(current, tick, std::memory_order_relaxed)) {
+    }
+}
+
+uint32_t PagedComponentPool::getChangeTick(EntityId entityId) const
+{
+    assert(has(entityId));
+    const auto [page, index] = getIndices(entityId);
+    return pages_[page].ticks[index];
+}
+
+bool PagedComponentPool::getNextChanged(
+    size_t& cursor, EntityId& entityId, uint32_t tick, size_t end) const
+{
+    while (getNext(cursor, entityId, end)) {
+        const auto [page, index] = getIndices(entityId);
+        if (pageTicks_[page].load(std::memory_order_relaxed) < tick) {
+            cursor = (page + 1) * pageSize_;
+            continue;
+        }
+        if (pages_[page].ticks[index] >= tick)
+            return true;
+    }
+    return false;
+}
+
+size_t PagedComponentPool::getCursorEnd() const
+{
+    return pages_.size() * pageSize_;
+}
+
+size_t PagedComponentPool::getCursorGranularity() const
+{
+    return pageSize_;
+}
+
+PagedComponentPool::Page::Page()
+    : data(nullptr, [](void* p) { ::operator delete(p); })
+    , occupied()
+{
+}
+
+std::pair<size_t, size_t> PagedComponentPool::getIndices(EntityId entityId) const
+{
+    const auto id = getIndex(entityId);
+    return std::pair<size_t, size_t>(id / pageSize_, id % pageSize_);
+}
+
+void* PagedComponentPool::getPointer(size_t page, size_t index)
+{
+    assert(pages_[page].data);
+    return reinterpret_cast<uint8_t*>(pages_[page].data.get()) + componentSize_ * index;
+}
+
+void PagedComponentPool::addPages(size_t count)
+{
+    const auto oldSize = pages_.size();
+    pages_.resize(oldSize + count);
+    for (size_t i = oldSize; i < pages_.size(); ++i)
+        pages_[i].occupied.resize((pageSize_ + 63) / 64, 0);
+    nonEmptyPages_.resize((pages_.size() + 63) / 64, 0);
+    // Adding is not thread-safe anyways, so we can just copy the atomics here
+    std::vector<std::atomic<uint32_t>> pageTicks(pages_.size());
+    for (size_t i = 0; i < oldSize; ++i)
+        pageTicks[i] = pageTicks_[i].load(std::memory_order_relaxed);
+    pageTicks_.swap(pageTicks);
+}
+
+void PagedComponentPool::allocatePage(size_t page)
+{
+    auto& pageObj = pages_[page];
+    if (!pageObj.data) {
+        pageObj.data.reset(::operator new(pageSize_* componentSize_));
+        pageObj.ticks.reset(new uint32_t[pageSize_]);
+        nonEmptyPages_[page / 64] |= 1ull << (page % 64);
+    }
+}
+
+void PagedComponentPool::clearSlots(size_t page, size_t index, size_t count)
+{
+    if (columns_.empty()) {
+        std::memset(getPointer(page, index), 0, count * componentSize_);
+        return;
+    }
+    const auto data = reinterpret_cast<uint8_t*>(pages_[page].data.get());
+    for (const auto& col : columns_)
+        std::memset(data + col.offset + index * col.size, 0, count * col.size);
+}
+
+size_t PagedComponentPool::findNonEmptyPage(size_t page) const
+{
+    if (page >= pages_.size())
+        return pages_.size();
+    for (size_t w = page / 64; w < nonEmptyPages_.size(); ++w) {
+        auto word = nonEmptyPages_[w];
+        if (w == page / 64)
+            word &= ~0ull << (page % 64);
+        if (word)
+            return w * 64 + countTrailingZeros(word);
+    }
+    return pages_.size();
+}
+
+SparseComponentPool::SparseComponentPool(size_t componentSize)
+    : componentSize_(componentSize)
+{
+}
+
+bool SparseComponentPool::has(EntityId entityId) const
+{
+    return getIndex(entityId) != noIndex;
+}
+
+void* SparseComponentPool::add(EntityId entityId)
+{
+    assert(!has(entityId));
+    const auto index = entities_.size();
+    assert(index < noIndex);
+    setIndex(entityId, static_cast<uint32_t>(index));
+    entities_.push_back(entityId);
+    ticks_.push_back(0);
+    // resize value-initializes, so the new component is zeroed already
+    data_.resize(data_.size() + componentSize_);
+    return data_.data() + index * componentSize_;
+}
+
+void* SparseComponentPool::get(EntityId entityId)
+{
+    assert(has(entityId));
+    return data_.data() + getIndex(entityId) * componentSize_;
+}
+
+void SparseComponentPool::remove(EntityId entityId)
+{
+    assert(has(entityId));
+    const auto index = getIndex(entityId);
+    const auto last = entities_.size() - 1;
+    if (index != last) {
+        std::memcpy(data_.data() + index * componentSize_, data_.data() + last * componentSize_,
+            componentSize_);
+        entities_[index] = entities_[last];
+        ticks_[index] = ticks_[last];
+        setIndex(entities_[index], index);
+    }
+    entities_.pop_back();
+    ticks_.pop_back();
+    data_.resize(data_.size() - componentSize_);
+    setIndex(entityId, noIndex);
+}
+
+void SparseComponentPool::addRange(EntityId first, size_t count, uint32_t tick)
+{
+    const auto begin = myl::getIndex(first);
+    const auto index = entities_.size();
+    assert(index + count < noIndex);
+    entities_.reserve(index + count);
+    for (size_t id = begin; id < begin + count; ++id) {
+        assert(!has(EntityId(id)));
+        setIndex(EntityId(id), static_cast<uint32_t>(entities_.size()));
+        entities_.push_back(EntityId(id));
+    }
+    ticks_.resize(index + count, tick);
+    data_.resize(data_.size() + count * componentSize_);
+}
+
+void SparseComponentPool::clear()
+{
+    data_.clear();
+    entities_.clear();
+    ticks_.clear();
+    sparse_.clear();
+}
+
+size_t SparseComponentPool::getSize() const
+{
+    return entities_.size();
+}
+
+bool SparseComponentPool::getNext(size_t& cursor, EntityId& entityId, size_t end) const
+{
+    if (cursor >= std::min(end, entities_.size()))
+        return false;
+    entityId = entities_[cursor++];
+    return true;
+}
+
+void SparseComponentPool::setChanged(EntityId entityId, uint32_t tick)
+{
+    assert(has(entityId));
+    ticks_[getIndex(entityId)] = tick;
+}
+
+uint32_t SparseComponentPool::getChangeTick(EntityId entityId) const
+{
+    assert(has(entityId));
+    return ticks_[getIndex(entityId)];
+}
+
+bool SparseComponentPool::getNextChanged(
+    size_t& cursor, EntityId& entityId, uint32_t tick, size_t end) const
+{
+    const auto last = std::min(end, entities_.size());
+    while (cursor < last) {
+        const auto index = cursor++;
+        if (ticks_[index] >= tick) {
+            entityId = entities_[index];
+            return true;
+        }
+    }
+    return false;
+}
+
+size_t SparseComponentPool::getCursorEnd() const
+{
+    return entities_.size();
+}
+
+size_t SparseComponentPool::getCursorGranularity() const
+{
+    return 64 / sizeof(EntityId);
+}
+
+const std::vector<EntityId>& SparseComponentPool::getEntities() const
+{
+    return entities_;
+}
+
+void* SparseComponentPool::getData()
+{
+    return data_.data();
+}
+
+uint32_t SparseComponentPool::getIndex(EntityId entityId) const
+{
+    const auto id = myl::getIndex(entityId);
+    const auto page = id / sparsePageSize;
+    if (page >= sparse_.size() || !sparse_[page])
+        return noIndex;
+    return sparse_[page][id % sparsePageSize];
+}
+
+void SparseComponentPool::setIndex(EntityId entityId, uint32_t index)
+{
+    const auto id = myl::getIndex(entityId);
+    const auto page = id / sparsePageSize;
+    if (page >= sparse_.size())
+        sparse_.resize(page + 1);
+    if (!sparse_[page]) {
+        sparse_[page].reset(new uint32_t[sparsePageSize]);
+        std::fill(sparse_[page].get(), sparse_[page].get() + sparsePageSize, noIndex);
+    }
+    sparse_[page][id % sparsePageSize] = index;
+}
+
+VirtualComponentPool::VirtualComponentPool(size_t componentSize, size_t alignment, bool hugePages)
+    : stride_(alignUp(componentSize, alignment))
+    , hugePages_(hugePages)
+    , chunkSize_(hugePages ? hugePageSize : commitChunkSize)
+{
+    // Slots are only aligned if the base is
+    assert(alignment > 0 && commitChunkSize % alignment == 0);
+    const auto maxSize = alignUp(maxEntityCount * stride_, chunkSize_);
+    // Reserve one more chunk, so the base can be aligned to chunkSize_ (for huge pages)
+    reservationSize_ = maxSize + chunkSize_;
+    reservation_ = reserveMemory(reservationSize_);
+    assert(reservation_ && "Could not reserve address space");
+    base_ = reinterpret_cast<uint8_t*>(
+        alignUp(reinterpret_cast<uintptr_t>(reservation_), chunkSize_));
+    const auto blockCount = (maxEntityCount + blockSize - 1) / blockSize;
+    blockTicks_.reset(new std::atomic<uint32_t>[blockCount]());
+}
+
+VirtualComponentPool::~VirtualComponentPool()
+{
+    releaseMemory(reservation_, reservationSize_);
+}
+
+bool VirtualComponentPool::has(EntityId entityId) const
+{
+    const auto index = getIndex(entityId);
+    return index < slotCount_ && (occupied_[index / 64] & (1ull << (index % 64)));
+}
+
+void* VirtualComponentPool::add(EntityId entityId)
+{
+    assert(!has(entityId));
+    const auto index = getIndex(entityId);
+    commit(index + 1);
+    occupied_[index / 64] |= 1ull << (index % 64);
+    ticks_[index] = 0;
+    size_++;
+    return getPointer(index);
+}
+
+void* VirtualComponentPool::get(EntityId entityId)
+{
+    assert(has(entityId));
+    return getPointer(getIndex(entityId));
+}
+
+void VirtualComponentPool::remove(EntityId entityId)
+{
+    assert(has(entityId));
+    const auto index = getIndex(entityId);
+    occupied_[index / 64] &= ~(1ull << (index % 64));
+    std::memset(getPointer(index), 0, stride_);
+    size_--;
+}
+
+void VirtualComponentPool::reserve(size_t capacity)
+{
+    commit(std::min(capacity, maxEntityCount));
+}
+
+void VirtualComponentPool::addRange(EntityId first, size_t count, uint32_t tick)
+{
+    if (count == 0)
+        return;
+    const auto begin = getIndex(first);
+    const auto end = begin + count;
+    commit(end);
+    // Set the occupied bits a word at a time
+    for (size_t i = begin; i < end;) {
+        const auto bit = i % 64;
+        const auto len = std::min(64 - bit, end - i);
+        const auto mask = (len == 64 ? ~0ull : (1ull << len) - 1) << bit;
+        assert(!(occupied_[i / 64] & mask));
+        occupied_[i / 64] |= mask;
+        i += len;
+    }
+    std::fill(ticks_.begin() + begin, ticks_.begin() + end, tick);
+    for (size_t block = begin / blockSize; block <= (end - 1) / blockSize; ++block)
+        blockTicks_[block] = std::max(blockTicks_[block].load(std::memory_order_relaxed), tick);
+    size_ += count;
+}
+
+void VirtualComponentPool::clear()
+{
+    if (committedSize_ > 0)
+        decommitMemory(base_, committedSize_);
+    for (size_t block = 0; block < (slotCount_ + blockSize - 1) / blockSize; ++block)
+        blockTicks_[block] = 0;
+    committedSize_ = 0;
+    slotCount_ = 0;
+    occupied_ = std::vector<uint64_t>();
+    ticks_ = std::vector<uint32_t>();
+    size_ = 0;
+}
+
+size_t VirtualComponentPool::getSize() const
+{
+    return size_;
+}
+
+bool VirtualComponentPool::getNext(size_t& cursor, EntityId& entityId, size_t end) const
+{
+    for (size_t w = cursor / 64; w < occupied_.size() && w * 64 < end; ++w) {
+        auto word = occupied_[w];
+        // Mask out the bits before cursor in the first word
+        if (w == cursor / 64)
+            word &= ~0ull << (cursor % 64);
+        if (word) {
+            const auto id = w * 64 + countTrailingZeros(word);
+            if (id >= end)
+                break;
+            entityId = EntityId(id);
+            cursor = id + 1;
+            return true;
+        }
+    }
+    cursor = std::max(cursor, std::min(end, slotCount_));
+    return false;
+}
+
+void VirtualComponentPool::setChanged(EntityId entityId, uint32_t tick)
+{
+    assert(has(entityId));
+    const auto index = getIndex(entityId);
+    ticks_[index] = tick;
+    // Ticks only go up, but we might still race with an older tick
+    auto& blockTick = blockTicks_[index / blockSize];
+    auto current = blockTick.load(std::memory_order_relaxed);
+    while (current < tick
+        && !blockTick.compare_exchange_weak(current, tick, std::memory_order_relaxed)) {
+    }
+}
+
+uint32_t VirtualComponentPool::getChangeTick(EntityId entityId) const
+{
+    assert(has(entityId));
+    return ticks_[getIndex(entityId)];
+}
+
+bool VirtualComponentPool::getNextChanged(
+    size_t& cursor, EntityId& entityId, uint32_t tick, size_t end) const
+{
+    while (getNext(cursor, entityId, end)) {
+        const auto index = getIndex(entityId);
+        if (blockTicks_[index / blockSize].load(std::memory_order_relaxed) < tick) {
+            cursor = (index / blockSize + 1) * blockSize;
+            continue;
+        }
+        if (ticks_[index] >= tick)
+            return true;
+    }
+    return false;
+}
+
+size_t VirtualComponentPool::getCursorEnd() const
+{
+    return slotCount_;
+}
+
+size_t VirtualComponentPool::getCursorGranularity() const
+{
+    return blockSize;
+}
+
+void* VirtualComponentPool::getPointer(size_t index)
+{
+    return base_ + index * stride_;
+}
+
+void VirtualComponentPool::commit(size_t count)
+{
+    assert(count <= maxEntityCount);
+    if (count <= slotCount_)
+        return;
+    const auto size = alignUp(count * stride_, chunkSize_);
+    const auto ok = commitMemory(base_ + committedSize_, size - committedSize_, hugePages_);
+    assert(ok && "Could not commit memory");
+    (void)ok;
+    committedSize_ = size;
+    slotCount_ = std::min(committedSize_ / stride_, maxEntityCount);
+    occupied_.resize((slotCount_ + 63) / 64, 0);
+    ticks_.resize(slotCount_, 0);
+}
+
+}
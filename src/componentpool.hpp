@@ -0,0 +1,325 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include "id.hpp"
+
+// Can be set with cmake -DMYL_ENTITY_INDEX_BITS=20
+#ifndef MYL_ENTITY_INDEX_BITS
+#define MYL_ENTITY_INDEX_BITS 24
+#endif
+
+namespace myl {
+
+/*
+ * An EntityId is a 32-bit handle. The low entityIndexBits are the index of the entity (in
+ * World and in the pools) and the remaining bits are the generation, which is incremented
+ * every time the entity with that index is destroyed. That way a stale handle to a destroyed
+ * entity does not accidentally refer to a new entity with the same index.
+ */
+struct EntityIdTag {
+};
+using EntityId = Id<EntityIdTag, uint32_t>;
+
+constexpr uint32_t entityIndexBits = MYL_ENTITY_INDEX_BITS;
+static_assert(entityIndexBits >= 8 && entityIndexBits < 32,
+    "MYL_ENTITY_INDEX_BITS has to leave some bits for the generation");
+constexpr uint32_t entityIndexMask = (1u << entityIndexBits) - 1;
+constexpr uint32_t entityGenerationMask = ~entityIndexMask >> entityIndexBits;
+// The index of maxId<EntityId>() is never used, so it can be used as an invalid id
+constexpr size_t maxEntityCount = entityIndexMask;
+
+constexpr size_t getIndex(EntityId id)
+{
+    return static_cast<uint32_t>(id) & entityIndexMask;
+}
+
+constexpr uint32_t getGeneration(EntityId id)
+{
+    return static_cast<uint32_t>(id) >> entityIndexBits;
+}
+
+constexpr EntityId makeEntityId(size_t index, uint32_t generation)
+{
+    return EntityId(static_cast<uint32_t>(index) | (generation << entityIndexBits));
+}
+
+// See ComponentPool::create
+struct ComponentPoolOptions {
+    // The sizes of the fields in order, only used for ComponentPool::Type::Soa
+    std::vector<size_t> columnSizes = {};
+    // Only used for ComponentPool::Type::Virtual. Use 64 to pad every component to a cache line.
+    size_t alignment = 1;
+    // Only used for ComponentPool::Type::Virtual
+    bool hugePages = false;
+    // Passed to ComponentPool::reserve
+    size_t capacity = 0;
+};
+
+/*
+ * A ComponentPool just manages memory for one component per entity. It does not know
+ * anything about the data it stores, so it does not call Struct::init or Struct::free.
+ * Freshly added components are zero-initialized.
+ * Pools only use the index of the entity ids. The ids returned from getNext might not have
+ * the right generation, so World has to fix them up.
+ */
+class ComponentPool {
+public:
+    // Soa is a paged pool that stores every field in it's own column (see PagedComponentPool)
+    enum class Type { Paged, Sparse, Soa, Virtual };
+
+    using Options = ComponentPoolOptions;
+
+    static std::unique_ptr<ComponentPool> create(
+        Type type, size_t componentSize, const Options& options = Options());
+
+    virtual ~ComponentPool() = default;
+
+    virtual bool has(EntityId entityId) const = 0;
+    // Pools with columns return nullptr from add and get, because there is no struct to
+    // point to. Use getColumn instead.
+    virtual void* add(EntityId entityId) = 0;
+    // No const overload, because you probably never have a const ComponentPool anyways
+    virtual void* get(EntityId entityId) = 0;
+    virtual void remove(EntityId entityId) = 0;
+
+    virtual bool hasColumns() const;
+    /*
+     * Returns a pointer to the value of the column (field) for the entity. The values for the
+     * following count - 1 entity ids are contiguous after it (whether they have the component
+     * or not), so SIMD loops can run over all of them.
+     */
+    virtual void* getColumn(EntityId entityId, size_t column, size_t& count);
+
+    // A hint, that entity indices < capacity will be used, so the pool can allocate up front
+    virtual void reserve(size_t capacity);
+
+    // Adds zeroed components for count entities starting at first, changed at tick
+    virtual void addRange(EntityId first, size_t count, uint32_t tick) = 0;
+    // Removes all components at once
+    virtual void clear() = 0;
+
+    // The number of components in the pool
+    virtual size_t getSize() const = 0;
+
+    static constexpr auto noEnd = std::numeric_limits<size_t>::max();
+
+    /*
+     * Iterate over all entities in the pool with:
+     * size_t cursor = 0; EntityId id;
+     * while (pool.getNext(cursor, id)) {}
+     * What the cursor means is up to the pool and removing components while iterating
+     * might skip some entities.
+     * Iteration stops before cursor reaches end, so a range of cursors (e.g. one part of
+     * EntityIterator::split) doesn't look at the rest of the pool.
+     */
+    virtual bool getNext(size_t& cursor, EntityId& entityId, size_t end = noEnd) const = 0;
+
+    /*
+     * Change tracking: Every component remembers the last tick (see World::getTick) it was
+     * changed in. Pools may also keep track of the last change per page, so iterating over
+     * changed components can skip whole pages that did not change.
+     * setChanged may be called concurrently for different entities.
+     */
+    virtual void setChanged(EntityId entityId, uint32_t tick) = 0;
+    virtual uint32_t getChangeTick(EntityId entityId) const = 0;
+    // Like getNext, but skips all components that were last changed before tick
+    virtual bool getNextChanged(
+        size_t& cursor, EntityId& entityId, uint32_t tick, size_t end = noEnd) const = 0;
+
+    // All cursors returned by getNext are <= getCursorEnd()
+    virtual size_t getCursorEnd() const = 0;
+    // Ranges of cursors that are a multiple of this in size are good for splitting up work
+    virtual size_t getCursorGranularity() const = 0;
+};
+
+/*
+ * Components are stored in pages (~1KB by default) indexed by entityId / pageSize.
+ * Pointers to components stay valid until the component is removed.
+ * This is the best choice for components most entities have.
+ * If columnSizes is not empty, the pages are struct-of-arrays: Every page has one array
+ * (column) per field, so a system that only reads one field doesn't pull the others into
+ * the cache.
+ */
+class PagedComponentPool : public ComponentPool {
+public:
+    PagedComponentPool(
+        size_t componentSize, size_t pageSize = 0, const std::vector<size_t>& columnSizes = {});
+
+    bool has(EntityId entityId) const override;
+    void* add(EntityId entityId) override;
+    void* get(EntityId entityId) override;
+    void remove(EntityId entityId) override;
+    bool hasColumns() const override;
+    // count is the number of slots left in the page
+    void* getColumn(EntityId entityId, size_t column, size_t& count) override;
+    // Only allocates the page table, pages are still allocated when they are used
+    void reserve(size_t capacity) override;
+    // Allocates pages and memsets whole runs of slots at once
+    void addRange(EntityId first, size_t count, uint32_t tick) override;
+    void clear() override;
+
+    size_t getSize() const override;
+    // The cursor is the entity id to continue searching at. Empty pages are skipped using
+    // a bitmap of non-empty pages and occupied slots are found a whole word at a time.
+    bool getNext(size_t& cursor, EntityId& entityId, size_t end = noEnd) const override;
+    void setChanged(EntityId entityId, uint32_t tick) override;
+    uint32_t getChangeTick(EntityId entityId) const override;
+    bool getNextChanged(
+        size_t& cursor, EntityId& entityId, uint32_t tick, size_t end = noEnd) const override;
+    size_t getCursorEnd() const override;
+    // One page
+    size_t getCursorGranularity() const override;
+
+private:
+    struct Page {
+        std::unique_ptr<void, void (*)(void*)> data;
+        std::unique_ptr<uint32_t[]> ticks; // allocated together with data
+        std::vector<uint64_t> occupied; // one bit per slot
+        size_t count = 0;
+
+        Page();
+    };
+
+    std::pair<size_t, size_t> getIndices(EntityId entityId) const;
+    void* getPointer(size_t page, size_t index);
+    void addPages(size_t count);
+    // Allocates the data of the page if it doesn't have any yet
+    void allocatePage(size_t page);
+    // Returns pages_.size() if there is no non-empty page >= page
+    size_t findNonEmptyPage(size_t page) const;
+    // Zeroes count slots starting at index
+    void clearSlots(size_t page, size_t index, size_t count);
+
+    struct Column {
+        size_t offset; // in the page
+        size_t size;
+    };
+
+    size_t componentSize_;
+    size_t pageSize_;
+    std::vector<Column> columns_;
+    std::vector<Page> pages_;
+    std::vector<uint64_t> nonEmptyPages_; // one bit per page
+    // The last change of any component in the page. Atomic, because different threads might
+    // change different components in the same page.
+    std::vector<std::atomic<uint32_t>> pageTicks_;
+    size_t size_ = 0;
+};
+
+/*
+ * A sparse set: The components are packed densely into one array with a parallel array
+ * of the entities they belong to. A (paged) sparse array maps entity ids to indices.
+ * Removing a component moves the last one into it's place, so pointers are invalidated
+ * by add and remove! Iterating over all components is O(count).
+ * This is the best choice for components few entities have.
+ */
+class SparseComponentPool : public ComponentPool {
+public:
+    SparseComponentPool(size_t componentSize);
+
+    bool has(EntityId entityId) const override;
+    void* add(EntityId entityId) override;
+    void* get(EntityId entityId) override;
+    void remove(EntityId entityId) override;
+    void addRange(EntityId first, size_t count, uint32_t tick) override;
+    void clear() override;
+
+    size_t getSize() const override;
+    // The cursor is an index into the dense arrays
+    bool getNext(size_t& cursor, EntityId& entityId, size_t end = noEnd) const override;
+    void setChanged(EntityId entityId, uint32_t tick) override;
+    uint32_t getChangeTick(EntityId entityId) const override;
+    // This has to look at the ticks of all components, but they are stored densely
+    bool getNextChanged(
+        size_t& cursor, EntityId& entityId, uint32_t tick, size_t end = noEnd) const override;
+    size_t getCursorEnd() const override;
+    // 64 bytes of entity ids
+    size_t getCursorGranularity() const override;
+
+    const std::vector<EntityId>& getEntities() const;
+    void* getData();
+
+private:
+    static constexpr size_t sparsePageSize = 1024;
+    static constexpr auto noIndex = std::numeric_limits<uint32_t>::max();
+
+    uint32_t getIndex(EntityId entityId) const;
+    void setIndex(EntityId entityId, uint32_t index);
+
+    size_t componentSize_;
+    std::vector<uint8_t> data_;
+    std::vector<EntityId> entities_;
+    std::vector<uint32_t> ticks_;
+    std::vector<std::unique_ptr<uint32_t[]>> sparse_;
+};
+
+/*
+ * Reserves address space for every possible entity index up front and only commits the
+ * memory (in 64KB chunks) when it is used. The component of an entity is always at
+ * base + index * stride, so get is a single multiply-add and pointers stay valid until the
+ * component is removed. The stride is the component size rounded up to the alignment.
+ * With hugePages the memory is committed in 2MB chunks and the OS is asked to back it with
+ * transparent huge pages (Linux only), which saves TLB misses for big pools.
+ * Like PagedComponentPool this is for components most entities have.
+ */
+class VirtualComponentPool : public ComponentPool {
+public:
+    VirtualComponentPool(size_t componentSize, size_t alignment = 1, bool hugePages = false);
+    ~VirtualComponentPool() override;
+
+    VirtualComponentPool(const VirtualComponentPool&) = delete;
+    VirtualComponentPool& operator=(const VirtualComponentPool&) = delete;
+
+    bool has(EntityId entityId) const override;
+    void* add(EntityId entityId) override;
+    void* get(EntityId entityId) override;
+    // Zeroes the slot, so add doesn't have to (committed memory is zeroed already)
+    void remove(EntityId entityId) override;
+    // Commits the memory for capacity components
+    void reserve(size_t capacity) override;
+    void addRange(EntityId first, size_t count, uint32_t tick) override;
+    // Decommits all memory
+    void clear() override;
+
+    size_t getSize() const override;
+    // The cursor is the entity id to continue searching at
+    bool getNext(size_t& cursor, EntityId& entityId, size_t end = noEnd) const override;
+    void setChanged(EntityId entityId, uint32_t tick) override;
+    uint32_t getChangeTick(EntityId entityId) const override;
+    bool getNextChanged(
+        size_t& cursor, EntityId& entityId, uint32_t tick, size_t end = noEnd) const override;
+    // The number of committed slots
+    size_t getCursorEnd() const override;
+    // One block (see blockSize)
+    size_t getCursorGranularity() const override;
+
+private:
+    // The last change of any component is tracked per block of slots, like the pages of
+    // PagedComponentPool
+    static constexpr size_t blockSize = 1024;
+
+    void* getPointer(size_t index);
+    // Makes sure the slots < count are committed
+    void commit(size_t count);
+
+    size_t stride_;
+    bool hugePages_;
+    size_t chunkSize_; // what is committed at once
+    void* reservation_;
+    size_t reservationSize_;
+    uint8_t* base_; // reservation_ aligned to chunkSize_
+    size_t committedSize_ = 0; // in bytes
+    size_t slotCount_ = 0; // the committed slots
+    std::vector<uint64_t> occupied_; // one bit per committed slot
+    std::vector<uint32_t> ticks_; // per committed slot
+    std::unique_ptr<std::atomic<uint32_t>[]> blockTicks_; // for all blocks
+    size_t size_ = 0;
+};
+
+}
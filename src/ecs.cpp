@@ -1,308 +1,1858 @@
 #include "ecs.hpp"
 
+#include <algorithm>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
 #include <iostream>
+#include <mutex>
+#include <new>
 
 #include "util.hpp"
 
 namespace myl {
 
-ComponentPool::ComponentPool(size_t componentSize, size_t pageSize)
-    : componentSize_(componentSize)
-    , pageSize_(pageSize)
+Component::Component(const std::string& name, Struct&& s, size_t alignment)
+    : id_(ComponentId::getNew())
+    , name_(name)
+    , struct_(s)
+    , alignment_(std::max(alignment, struct_.getAlignment()))
+{
+}
+
+ComponentId Component::getId() const
+{
+    return id_;
+}
+
+const std::string& Component::getName() const
+{
+    return name_;
+}
+
+const Struct& Component::getStruct() const
+{
+    return struct_;
+}
+
+size_t Component::getAlignment() const
+{
+    return alignment_;
+}
+
+bool Component::isTag() const
+{
+    return struct_.getSize() == 0;
+}
+
+ComponentMask::ComponentMask(ComponentId id)
+{
+    add(id);
+}
+
+void ComponentMask::add(ComponentId id)
+{
+    const auto idx = static_cast<size_t>(id);
+    words_[idx / 64] |= 1ull << (idx % 64);
+}
+
+void ComponentMask::remove(ComponentId id)
+{
+    const auto idx = static_cast<size_t>(id);
+    words_[idx / 64] &= ~(1ull << (idx % 64));
+}
+
+ComponentMask ComponentMask::operator+(ComponentId id) const
+{
+    ComponentMask mask(*this);
+    mask.add(id);
+    return mask;
+}
+
+ComponentMask ComponentMask::operator+(const ComponentMask& other) const
+{
+    ComponentMask mask;
+    for (size_t i = 0; i < wordCount; ++i)
+        mask.words_[i] = words_[i] | other.words_[i];
+    return mask;
+}
+
+ComponentMask& ComponentMask::operator+=(ComponentId id)
+{
+    add(id);
+    return *this;
+}
+
+ComponentMask& ComponentMask::operator-=(ComponentId id)
+{
+    remove(id);
+    return *this;
+}
+
+void ComponentMask::clear()
+{
+    words_.fill(0);
+}
+
+const ComponentMask::Words& ComponentMask::getMask() const
+{
+    return words_;
+}
+
+bool ComponentMask::operator==(const ComponentMask& other) const
+{
+    return words_ == other.words_;
+}
+
+bool ComponentMask::operator!=(const ComponentMask& other) const
+{
+    return words_ != other.words_;
+}
+
+size_t ComponentMask::Hash::operator()(const ComponentMask& mask) const
+{
+    // boost::hash_combine
+    size_t hash = 0;
+    for (const auto word : mask.words_)
+        hash ^= std::hash<uint64_t>()(word) + 0x9e3779b9 + (hash << 6) + (hash >> 2);
+    return hash;
+}
+
+ComponentMask operator+(ComponentId a, ComponentId b)
+{
+    ComponentMask mask;
+    mask.add(a);
+    mask.add(b);
+    return mask;
+}
+
+bool ComponentAccess::conflicts(const ComponentAccess& other) const
+{
+    // Reading the same components in parallel is fine, everything else is not
+    return !writes.includesNot(other.reads + other.writes)
+        || !other.writes.includesNot(reads + writes);
+}
+
+Archetype::Archetype(const ComponentMask& mask, const std::vector<Component>& components)
+    : mask_(mask)
+{
+    columnIndex_.fill(noColumn);
+    size_t rowSize = sizeof(EntityId);
+    for (const auto& component : components) {
+        if (mask.includes(component.getId()) && !component.isTag()) {
+            const auto size = component.getStruct().getSize();
+            columnIndex_[static_cast<size_t>(component.getId())]
+                = static_cast<ColumnIndex>(columns_.size());
+            columns_.push_back(Column { component.getId(), size, 0, 0 });
+            rowSize += size + sizeof(uint32_t);
+        }
+    }
+
+    // Alignment might waste a few bytes, so we might have to fit in fewer rows
+    chunkCapacity_ = std::max(chunkSize / rowSize, size_t(1));
+    while (true) {
+        size_t offset = chunkCapacity_ * sizeof(EntityId);
+        for (auto& column : columns_) {
+            const auto& strct = components[static_cast<size_t>(column.componentId)].getStruct();
+            offset = align(offset, strct.getAlignment());
+            column.offset = offset;
+            offset += chunkCapacity_ * column.size;
+        }
+        offset = align(offset, alignof(uint32_t));
+        for (auto& column : columns_) {
+            column.tickOffset = offset;
+            offset += chunkCapacity_ * sizeof(uint32_t);
+        }
+        chunkBytes_ = offset;
+        if (chunkBytes_ <= chunkSize || chunkCapacity_ == 1)
+            break;
+        chunkCapacity_--;
+    }
+}
+
+const ComponentMask& Archetype::getMask() const
+{
+    return mask_;
+}
+
+size_t Archetype::getSize() const
+{
+    return size_;
+}
+
+size_t Archetype::add(EntityId entityId)
+{
+    const auto row = size_;
+    const auto chunk = row / chunkCapacity_;
+    const auto index = row % chunkCapacity_;
+    if (chunk >= chunks_.size()) {
+        chunks_.emplace_back(new uint8_t[chunkBytes_]);
+        chunkTicks_.emplace_back(columns_.size());
+    }
+    auto chunkData = getChunk(chunk);
+    reinterpret_cast<EntityId*>(chunkData)[index] = entityId;
+    for (const auto& column : columns_) {
+        std::memset(chunkData + column.offset + index * column.size, 0, column.size);
+        reinterpret_cast<uint32_t*>(chunkData + column.tickOffset)[index] = 0;
+    }
+    size_++;
+    return row;
+}
+
+std::optional<EntityId> Archetype::remove(size_t row)
+{
+    assert(row < size_);
+    const auto last = size_ - 1;
+    std::optional<EntityId> moved;
+    if (row != last) {
+        auto dstChunk = getChunk(row / chunkCapacity_);
+        auto srcChunk = getChunk(last / chunkCapacity_);
+        const auto dstIndex = row % chunkCapacity_;
+        const auto srcIndex = last % chunkCapacity_;
+        moved = reinterpret_cast<EntityId*>(srcChunk)[srcIndex];
+        reinterpret_cast<EntityId*>(dstChunk)[dstIndex] = *moved;
+        for (size_t c = 0; c < columns_.size(); ++c) {
+            const auto& column = columns_[c];
+            std::memcpy(dstChunk + column.offset + dstIndex * column.size,
+                srcChunk + column.offset + srcIndex * column.size, column.size);
+            const auto tick = reinterpret_cast<uint32_t*>(srcChunk + column.tickOffset)[srcIndex];
+            reinterpret_cast<uint32_t*>(dstChunk + column.tickOffset)[dstIndex] = tick;
+            auto& chunkTick = chunkTicks_[row / chunkCapacity_][c];
+            chunkTick = std::max(chunkTick.load(), tick);
+        }
+    }
+    size_--;
+
+    // Keep one empty chunk around, so an entity bouncing between archetypes doesn't allocate
+    const auto usedChunks = (size_ + chunkCapacity_ - 1) / chunkCapacity_;
+    if (chunks_.size() > usedChunks + 1) {
+        chunks_.pop_back();
+        chunkTicks_.pop_back();
+    }
+    return moved;
+}
+
+bool Archetype::hasColumn(ComponentId compId) const
+{
+    return columnIndex_[static_cast<size_t>(compId)] != noColumn;
+}
+
+void* Archetype::get(size_t row, ComponentId compId)
+{
+    assert(row < size_);
+    assert(hasColumn(compId));
+    const auto& column = columns_[columnIndex_[static_cast<size_t>(compId)]];
+    return getChunk(row / chunkCapacity_) + column.offset + (row % chunkCapacity_) * column.size;
+}
+
+EntityId Archetype::getEntity(size_t row) const
+{
+    assert(row < size_);
+    const auto chunk = chunks_[row / chunkCapacity_].get();
+    return reinterpret_cast<const EntityId*>(chunk)[row % chunkCapacity_];
+}
+
+size_t Archetype::getChunkCapacity() const
+{
+    return chunkCapacity_;
+}
+
+size_t Archetype::getChunkCount() const
+{
+    return (size_ + chunkCapacity_ - 1) / chunkCapacity_;
+}
+
+size_t Archetype::getChunkSize(size_t chunk) const
+{
+    assert(chunk < getChunkCount());
+    return std::min(size_ - chunk * chunkCapacity_, chunkCapacity_);
+}
+
+const EntityId* Archetype::getChunkEntities(size_t chunk) const
+{
+    return reinterpret_cast<const EntityId*>(chunks_[chunk].get());
+}
+
+void* Archetype::getChunkColumn(size_t chunk, ComponentId compId)
+{
+    assert(hasColumn(compId));
+    return getChunk(chunk) + columns_[columnIndex_[static_cast<size_t>(compId)]].offset;
+}
+
+void* Archetype::get(size_t chunk, size_t index, ComponentId compId)
+{
+    assert(chunk * chunkCapacity_ + index < size_);
+    assert(hasColumn(compId));
+    const auto& column = columns_[columnIndex_[static_cast<size_t>(compId)]];
+    return getChunk(chunk) + column.offset + index * column.size;
+}
+
+void Archetype::setChanged(size_t row, ComponentId compId, uint32_t tick)
+{
+    assert(row < size_);
+    assert(hasColumn(compId));
+    const auto c = columnIndex_[static_cast<size_t>(compId)];
+    const auto chunk = row / chunkCapacity_;
+    reinterpret_cast<uint32_t*>(getChunk(chunk) + columns_[c].tickOffset)[row % chunkCapacity_]
+        = tick;
+    // See PagedComponentPool::setChanged
+    auto& chunkTick = chunkTicks_[chunk][c];
+    auto current = chunkTick.load(std::memory_order_relaxed);
+    while (current < tick
+        && !chunkTick.compare_exchange_weak(current, tick, std::memory_order_relaxed)) {
+    }
+}
+
+uint32_t Archetype::getChangeTick(size_t row, ComponentId compId) const
+{
+    assert(row < size_);
+    return getChunkChangeTicks(row / chunkCapacity_, compId)[row % chunkCapacity_];
+}
+
+uint32_t Archetype::getChunkChangeTick(size_t chunk, ComponentId compId) const
+{
+    assert(hasColumn(compId));
+    return chunkTicks_[chunk][columnIndex_[static_cast<size_t>(compId)]].load(
+        std::memory_order_relaxed);
+}
+
+const uint32_t* Archetype::getChunkChangeTicks(size_t chunk, ComponentId compId) const
+{
+    assert(hasColumn(compId));
+    const auto& column = columns_[columnIndex_[static_cast<size_t>(compId)]];
+    return reinterpret_cast<const uint32_t*>(chunks_[chunk].get() + column.tickOffset);
+}
+
+uint8_t* Archetype::getChunk(size_t chunk)
+{
+    assert(chunk < chunks_.size());
+    return chunks_[chunk].get();
+}
+
+Prefab::Prefab(World& world)
+    : world_(&world)
+{
+}
+
+Prefab::~Prefab()
+{
+    clear();
+}
+
+Prefab::Prefab(Prefab&& other)
+    : world_(other.world_)
+    , mask_(other.mask_)
+    , components_(std::move(other.components_))
+{
+    other.mask_.clear();
+    other.components_.clear();
+}
+
+Prefab& Prefab::operator=(Prefab&& other)
+{
+    clear();
+    world_ = other.world_;
+    mask_ = other.mask_;
+    components_ = std::move(other.components_);
+    other.mask_.clear();
+    other.components_.clear();
+    return *this;
+}
+
+const ComponentMask& Prefab::getMask() const
+{
+    return mask_;
+}
+
+bool Prefab::hasComponent(ComponentId compId) const
+{
+    return mask_.includes(compId);
+}
+
+void* Prefab::addComponentBuffer(ComponentId compId)
+{
+    assert(!hasComponent(compId));
+    const auto compIndex = static_cast<size_t>(compId);
+    const auto& component = world_->getComponent(compId);
+    const auto& strct = component.getStruct();
+    if (components_.size() <= compIndex)
+        components_.resize(compIndex + 1, nullptr);
+    // Aligned like the components in the pool, which they are copied to
+    auto ptr = ::operator new(strct.getSize(), std::align_val_t(component.getAlignment()));
+    std::memset(ptr, 0, strct.getSize());
+    strct.init(ptr);
+    components_[compIndex] = ptr;
+    mask_ += compId;
+    return ptr;
+}
+
+void* Prefab::getComponentBuffer(ComponentId compId)
+{
+    assert(hasComponent(compId));
+    return components_[static_cast<size_t>(compId)];
+}
+
+EntityId Prefab::instantiate(size_t count) const
+{
+    // newEntities reads a prototype for every component in the mask
+    auto prototypes = components_;
+    prototypes.resize(world_->getComponents().size(), nullptr);
+    return world_->newEntities(count, mask_, prototypes.data());
+}
+
+void Prefab::clear()
+{
+    for (size_t compId = 0; compId < components_.size(); ++compId) {
+        if (components_[compId]) {
+            const auto& component = world_->getComponent(ComponentId(compId));
+            component.getStruct().free(components_[compId]);
+            ::operator delete(components_[compId], std::align_val_t(component.getAlignment()));
+        }
+    }
+    components_.clear();
+    mask_.clear();
+}
+
+World::World()
+{
+    // The default field allocator belongs to the thread that uses it first (see
+    // SlabAllocator), which should be the one that owns the World.
+    getFieldAllocator();
+}
+
+World::~World()
+{
+    if (fieldArena_)
+        endFieldArena();
+
+    // We just have to make sure we call Struct::free here, because the componentPool
+    // can't do that itself. The actual freeing is however still done by the pool (or
+    // archetype), which releases whole pages, so trivial components are not visited at all.
+    if (storage_ == Storage::Archetypes) {
+        for (auto& archetype : archetypes_) {
+            nonTrivial_.forEach([&](ComponentId compId) {
+                if (!archetype.hasColumn(compId))
+                    return;
+                const auto& strct = components_[static_cast<size_t>(compId)].getStruct();
+                for (size_t row = 0; row < archetype.getSize(); ++row)
+                    strct.free(archetype.get(row, compId));
+            });
+        }
+        return;
+    }
+
+    nonTrivial_.forEach([this](ComponentId compId) {
+        const auto& strct = components_[static_cast<size_t>(compId)].getStruct();
+        auto& pool = *componentPools_[static_cast<size_t>(compId)];
+        size_t cursor = 0;
+        EntityId id(0);
+        while (pool.getNext(cursor, id))
+            strct.free(pool.get(id));
+    });
+}
+
+void World::setStorage(Storage storage)
+{
+    assert(entities_.empty());
+    storage_ = storage;
+    archetypes_.clear();
+    archetypeIndices_.clear();
+    if (storage_ == Storage::Archetypes)
+        getArchetype(ComponentMask());
+}
+
+World::Storage World::getStorage() const
+{
+    return storage_;
+}
+
+const std::vector<Component>& World::getComponents()
+{
+    return components_;
+}
+
+bool World::entityExists(EntityId id) const
+{
+    const auto idx = getIndex(id);
+    return idx < entities_.size() && entities_[idx].exists
+        && entities_[idx].generation == getGeneration(id);
+}
+
+void World::reserveEntities(size_t count)
+{
+    assert(count <= maxEntityCount);
+    entities_.reserve(count);
+    for (auto& pool : componentPools_) {
+        if (pool)
+            pool->reserve(count);
+    }
+}
+
+EntityId World::newEntity()
+{
+    const auto id
+        = getEntityId(freeIndices_.empty() ? nextEntityId_++ : freeIndices_.pop());
+    createEntity(id);
+    return id;
+}
+
+EntityId World::newEntities(size_t count, const ComponentMask& mask)
+{
+    return newEntities(count, mask, nullptr);
+}
+
+EntityId World::newEntities(
+    size_t count, const ComponentMask& mask, const void* const* prototypes)
+{
+    // Trivial components are zero-initialized by the pools/archetypes already
+    const auto needsInit = [prototypes](const Component& component) {
+        return !component.getStruct().isTrivial()
+            || (prototypes && prototypes[static_cast<size_t>(component.getId())]);
+    };
+    const auto initComponent = [prototypes](const Component& component, void* ptr) {
+        const auto prototype = prototypes ? prototypes[static_cast<size_t>(component.getId())]
+                                          : nullptr;
+        if (prototype)
+            component.getStruct().copy(ptr, prototype);
+        else
+            component.getStruct().init(ptr);
+    };
+
+    /* Reuse a run of free indices if there is one, so creating and destroying entities in a
+     * loop doesn't grow the world, and only take new ones otherwise. New ones all have
+     * generation 0 and reused ones get the same generation, so the handles are contiguous.
+     */
+    size_t first = 0;
+    if (const auto run = count > 0 ? freeIndices_.popRange(count) : std::nullopt) {
+        first = *run;
+        unifyGenerations(first, count);
+    } else {
+        first = nextEntityId_.fetch_add(count);
+        assert(first + count <= maxEntityCount);
+        entities_.resize(first + count, Entity { false, ComponentMask() });
+    }
+    for (size_t i = first; i < first + count; ++i) {
+        entities_[i].exists = true;
+        entities_[i].components = mask;
+        if (storage_ == Storage::Pools)
+            entities_[i].allocated = mask;
+    }
+
+    if (storage_ == Storage::Archetypes) {
+        const auto archetypeIndex = getArchetype(mask);
+        auto& archetype = archetypes_[archetypeIndex];
+        for (size_t i = first; i < first + count; ++i) {
+            entities_[i].archetype = archetypeIndex;
+            entities_[i].row = archetype.add(getEntityId(i));
+            for (const auto& component : components_) {
+                if (mask.includes(component.getId()) && !component.isTag()) {
+                    initComponent(component, archetype.get(entities_[i].row, component.getId()));
+                    archetype.setChanged(entities_[i].row, component.getId(), tick_);
+                }
+            }
+        }
+    } else {
+        for (const auto& component : components_) {
+            const auto compId = component.getId();
+            if (!mask.includes(compId) || component.isTag())
+                continue;
+            auto& pool = *componentPools_[static_cast<size_t>(compId)];
+            pool.addRange(getEntityId(first), count, tick_);
+            if (!needsInit(component))
+                continue;
+            if (pool.hasColumns()) {
+                // SoA components are trivial, so the prototype can just be scattered
+                for (size_t i = first; i < first + count; ++i)
+                    setComponentData(
+                        getEntityId(i), compId, nullptr, prototypes[static_cast<size_t>(compId)]);
+                continue;
+            }
+            for (size_t i = first; i < first + count; ++i)
+                initComponent(component, pool.get(getEntityId(i)));
+        }
+    }
+
+    for (size_t i = first; i < first + count; ++i) {
+        const auto id = getEntityId(i);
+        updateQueries(id);
+        mask.forEach([this, id](ComponentId compId) { notify(compId, ComponentEvent::Add, id); });
+    }
+    return getEntityId(first);
+}
+
+EntityId World::getEntityId(size_t index) const
+{
+    assert(index < maxEntityCount);
+    return makeEntityId(index, index < entities_.size() ? entities_[index].generation : 0);
+}
+
+uint32_t World::unifyGenerations(size_t first, size_t count)
+{
+    /* Raising the generation of a free index is like destroying it a few more times, which
+     * brings stale handles closer to wrapping around. So take the generation that raises the
+     * others the least, which is the one right before the largest gap between them (modulo
+     * the generation range).
+     */
+    std::vector<uint32_t> generations;
+    generations.reserve(count);
+    for (size_t i = first; i < first + count; ++i) {
+        assert(!entities_[i].exists);
+        generations.push_back(entities_[i].generation);
+    }
+    std::sort(generations.begin(), generations.end());
+    generations.erase(std::unique(generations.begin(), generations.end()), generations.end());
+
+    auto generation = generations.back();
+    uint32_t largestGap = generations.front() + entityGenerationMask + 1 - generations.back();
+    for (size_t i = 1; i < generations.size(); ++i) {
+        if (generations[i] - generations[i - 1] > largestGap) {
+            largestGap = generations[i] - generations[i - 1];
+            generation = generations[i - 1];
+        }
+    }
+    for (size_t i = first; i < first + count; ++i)
+        entities_[i].generation = generation;
+    return generation;
+}
+
+void World::createEntity(EntityId id)
+{
+    const auto idx = getIndex(id);
+    // Command buffers might have taken ids from nextEntityId_ that don't exist yet
+    if (idx >= entities_.size())
+        entities_.resize(idx + 1, Entity { false, ComponentMask() });
+    assert(!entities_[idx].exists && entities_[idx].generation == getGeneration(id));
+    entities_[idx].exists = true;
+    entities_[idx].components.clear();
+
+    if (storage_ == Storage::Archetypes) {
+        auto& entity = entities_[getIndex(id)];
+        entity.archetype = 0;
+        entity.row = archetypes_[0].add(id);
+    }
+    updateQueries(id);
+}
+
+void World::destroyEntity(EntityId id)
+{
+    freeEntity(id);
+    freeIndices_.push(getIndex(id));
+}
+
+void World::destroyEntities(const EntityId* ids, size_t count)
+{
+    for (size_t i = 0; i < count; ++i)
+        freeEntity(ids[i]);
+    for (size_t i = 0; i < count; ++i)
+        freeIndices_.push(getIndex(ids[i]));
+}
+
+void World::destroyEntities(const std::vector<EntityId>& ids)
+{
+    destroyEntities(ids.data(), ids.size());
+}
+
+void World::destroyAllEntities(bool freeFields)
+{
+    playbackCommands();
+    releaseReservedIds();
+    entities_.resize(nextEntityId_, Entity { false, ComponentMask() });
+
+    if (freeFields) {
+        for (size_t i = 0; i < entities_.size(); ++i) {
+            if (entities_[i].exists)
+                freeEntity(getEntityId(i));
+        }
+    } else {
+        // Everything freeEntity does, but the pools and archetypes are cleared all at once
+        for (size_t i = 0; i < entities_.size(); ++i) {
+            auto& entity = entities_[i];
+            if (!entity.exists)
+                continue;
+            const auto id = getEntityId(i);
+            const auto& mask = storage_ == Storage::Archetypes
+                ? archetypes_[entity.archetype].getMask()
+                : entity.allocated;
+            mask.forEach([&](ComponentId compId) { notify(compId, ComponentEvent::Destroy, id); });
+            entity.exists = false;
+            entity.components.clear();
+            entity.allocated.clear();
+            entity.generation = (entity.generation + 1) & entityGenerationMask;
+        }
+        if (storage_ == Storage::Archetypes) {
+            std::vector<Archetype> archetypes;
+            archetypes.reserve(archetypes_.size());
+            for (const auto& archetype : archetypes_)
+                archetypes.emplace_back(archetype.getMask(), components_);
+            archetypes_ = std::move(archetypes);
+        } else {
+            for (auto& pool : componentPools_) {
+                if (pool)
+                    pool->clear();
+            }
+        }
+        for (auto& query : queries_) {
+            query.members.clear();
+            query.indices.clear();
+        }
+    }
+
+    freeIndices_ = IndexFreeList();
+    for (size_t i = 0; i < entities_.size(); ++i)
+        freeIndices_.push(i);
+}
+
+void World::beginFieldArena()
+{
+    assert(!fieldArena_);
+    playbackCommands();
+    preArenaEntities_.clear();
+    for (size_t i = 0; i < entities_.size(); ++i) {
+        if (entities_[i].exists)
+            preArenaEntities_.push_back(getEntityId(i));
+    }
+    fieldArena_ = std::make_unique<SlabAllocator>(getFieldAllocator());
+    fieldArenaPrevious_ = setFieldAllocator(fieldArena_.get());
+}
+
+void World::endFieldArena()
+{
+    assert(fieldArena_);
+    assert(&getFieldAllocator() == fieldArena_.get() && "Arenas have to end in reverse order");
+    playbackCommands();
+    // Their fields may still be (partly) from the previous allocator, so they are freed properly
+    for (const auto id : preArenaEntities_) {
+        if (entityExists(id))
+            destroyEntity(id);
+    }
+    preArenaEntities_.clear();
+    destroyAllEntities(false);
+    setFieldAllocator(fieldArenaPrevious_);
+    fieldArena_.reset(); // releases everything
+}
+
+EntityId EntityRemap::get(EntityId oldId) const
+{
+    const auto index = getIndex(oldId);
+    if (index >= oldIds_.size() || oldIds_[index] != oldId)
+        return maxId<EntityId>();
+    return newIds_[index];
+}
+
+EntityId EntityRemap::getByIndex(size_t oldIndex) const
+{
+    return oldIndex < newIds_.size() ? newIds_[oldIndex] : maxId<EntityId>();
+}
+
+EntityRemap World::compact(const std::function<uint64_t(EntityId)>& sortKey)
+{
+    // Pending commands and reserved ids refer to the old ids
+    playbackCommands();
+    releaseReservedIds();
+    // The released ids might have never been created, but they are in the free list, so they
+    // have to get an entry to be part of the new free list.
+    entities_.resize(nextEntityId_, Entity { false, ComponentMask() });
+
+    std::vector<size_t> order; // old indices in the new order
+    for (size_t i = 0; i < entities_.size(); ++i) {
+        if (entities_[i].exists)
+            order.push_back(i);
+    }
+    if (sortKey) {
+        std::vector<uint64_t> keys(entities_.size());
+        for (const auto index : order)
+            keys[index] = sortKey(getEntityId(index));
+        std::stable_sort(order.begin(), order.end(),
+            [&keys](size_t a, size_t b) { return keys[a] < keys[b]; });
+    } else {
+        std::stable_sort(order.begin(), order.end(), [this](size_t a, size_t b) {
+            return entities_[a].components.getMask() < entities_[b].components.getMask();
+        });
+    }
+
+    EntityRemap remap;
+    remap.oldIds_.assign(entities_.size(), maxId<EntityId>());
+    remap.newIds_.assign(entities_.size(), maxId<EntityId>());
+    std::vector<Entity> entities(entities_.size(), Entity { false, ComponentMask() });
+    for (size_t i = 0; i < entities.size(); ++i) {
+        // Every index gets a new generation, so all old ids are invalid afterwards
+        const auto generation = (entities_[i].generation + 1) & entityGenerationMask;
+        if (i < order.size()) {
+            entities[i] = entities_[order[i]];
+            remap.oldIds_[order[i]] = getEntityId(order[i]);
+            remap.newIds_[order[i]] = makeEntityId(i, generation);
+        }
+        entities[i].generation = generation;
+    }
+
+    // Components are trivially relocatable, so they are just memcpy'd to their new place
+    if (storage_ == Storage::Archetypes) {
+        std::vector<Archetype> archetypes;
+        archetypes.reserve(archetypes_.size());
+        for (const auto& archetype : archetypes_)
+            archetypes.emplace_back(archetype.getMask(), components_);
+        for (size_t i = 0; i < order.size(); ++i) {
+            const auto& oldEntity = entities_[order[i]];
+            auto& src = archetypes_[oldEntity.archetype];
+            auto& dst = archetypes[oldEntity.archetype];
+            const auto row = dst.add(remap.newIds_[order[i]]);
+            for (const auto& component : components_) {
+                const auto compId = component.getId();
+                if (!src.hasColumn(compId))
+                    continue;
+                std::memcpy(dst.get(row, compId), src.get(oldEntity.row, compId),
+                    component.getStruct().getSize());
+                dst.setChanged(row, compId, src.getChangeTick(oldEntity.row, compId));
+            }
+            entities[i].row = row;
+        }
+        archetypes_ = std::move(archetypes);
+    } else {
+        // Copies between a pool and a buffer with the whole component. SoA pools are
+        // gathered and scattered field by field.
+        const auto copy = [](ComponentPool& pool, const Struct& strct, EntityId id,
+                              uint8_t* buffer, bool toBuffer) {
+            const auto move = [toBuffer](void* ptr, uint8_t* buf, size_t size) {
+                if (toBuffer)
+                    std::memcpy(buf, ptr, size);
+                else
+                    std::memcpy(ptr, buf, size);
+            };
+            if (!pool.hasColumns()) {
+                move(pool.get(id), buffer, strct.getSize());
+                return;
+            }
+            const auto& fields = strct.getFields();
+            for (size_t f = 0; f < fields.size(); ++f) {
+                size_t count = 0;
+                move(pool.getColumn(id, f, count), buffer + fields[f].offset, fields[f].size);
+            }
+        };
+
+        std::vector<uint8_t> data;
+        std::vector<uint32_t> ticks;
+        std::vector<size_t> indices; // the new ones
+        for (size_t compId = 0; compId < componentPools_.size(); ++compId) {
+            if (!componentPools_[compId]) // tags
+                continue;
+            auto& pool = *componentPools_[compId];
+            const auto& strct = components_[compId].getStruct();
+            const auto size = strct.getSize();
+            data.resize(pool.getSize() * size);
+            ticks.clear();
+            indices.clear();
+            for (size_t i = 0; i < order.size(); ++i) {
+                // Pools only use the index
+                const auto oldId = makeEntityId(order[i], 0);
+                if (!pool.has(oldId))
+                    continue;
+                copy(pool, strct, oldId, data.data() + indices.size() * size, true);
+                ticks.push_back(pool.getChangeTick(oldId));
+                indices.push_back(i);
+            }
+            pool.clear();
+            for (size_t c = 0; c < indices.size(); ++c) {
+                const auto id = makeEntityId(indices[c], entities[indices[c]].generation);
+                pool.add(id);
+                copy(pool, strct, id, data.data() + c * size, false);
+                pool.setChanged(id, ticks[c]);
+            }
+        }
+    }
+
+    entities_ = std::move(entities);
+    freeIndices_ = IndexFreeList();
+    for (size_t i = order.size(); i < entities_.size(); ++i)
+        freeIndices_.push(i);
+
+    for (auto& query : queries_) {
+        if (!query.active)
+            continue;
+        query.members.clear();
+        query.indices.clear();
+        for (size_t i = 0; i < order.size(); ++i) {
+            if (query.matches(entities_[i]))
+                query.add(getEntityId(i));
+        }
+    }
+    return remap;
+}
+
+void World::freeEntity(EntityId id)
+{
+    const auto idx = getIndex(id);
+    assert(entityExists(id));
+    auto& entity = entities_[idx];
+    if (storage_ == Storage::Archetypes) {
+        auto& archetype = archetypes_[entity.archetype];
+        archetype.getMask().forEach([&](ComponentId compId) {
+            notify(compId, ComponentEvent::Destroy, id);
+            const auto& component = components_[static_cast<size_t>(compId)];
+            if (!component.isTag())
+                component.getStruct().free(archetype.get(entity.row, compId));
+        });
+        const auto moved = archetype.remove(entity.row);
+        if (moved)
+            entities_[getIndex(*moved)].row = entity.row;
+    } else {
+        // Disabled components have to be removed too, so use the allocated components
+        entity.allocated.forEach([&](ComponentId compId) {
+            notify(compId, ComponentEvent::Destroy, id);
+            const auto compIndex = static_cast<size_t>(compId);
+            if (!componentPools_[compIndex]) // tags
+                return;
+            auto& pool = *componentPools_[compIndex];
+            components_[compIndex].getStruct().free(pool.get(id));
+            pool.remove(id);
+        });
+    }
+    entity.exists = false;
+    entity.components.clear();
+    entity.allocated.clear();
+    // Invalidates all handles to this entity
+    entity.generation = (entity.generation + 1) & entityGenerationMask;
+    updateQueries(id);
+}
+
+bool World::hasComponent(EntityId id, ComponentId compId)
+{
+    assert(entityExists(id));
+    return entities_[getIndex(id)].components.includes(compId);
+}
+
+void World::removeComponent(EntityId id, ComponentId compId)
+{
+    // This does not assert hasComponent, because we might remove a disabled component
+    // If there isn't even a disabled component the ComponentPool::get will abort
+    const auto compIndex = static_cast<size_t>(compId);
+    auto& entity = entities_[getIndex(id)];
+    notify(compId, ComponentEvent::Remove, id);
+    components_[compIndex].getStruct().free(getComponentBuffer(id, compId));
+    entity.components -= compId;
+    if (storage_ == Storage::Archetypes) {
+        auto mask = archetypes_[entity.archetype].getMask();
+        mask -= compId;
+        moveEntity(id, mask);
+    } else {
+        assert(entity.allocated.includes(compId));
+        entity.allocated -= compId;
+        if (!components_[compIndex].isTag())
+            componentPools_[compIndex]->remove(id);
+    }
+    updateQueries(id);
+}
+
+void World::registerPrefab(const std::string& name, Prefab&& prefab)
+{
+    assert(!hasPrefab(name));
+    prefabs_.emplace(name, std::move(prefab));
+}
+
+bool World::hasPrefab(const std::string& name) const
+{
+    return prefabs_.count(name) > 0;
+}
+
+Prefab& World::getPrefab(const std::string& name)
+{
+    return prefabs_.at(name);
+}
+
+void World::clearComponent(ComponentId compId)
+{
+    const auto compIndex = static_cast<size_t>(compId);
+    if (storage_ == Storage::Archetypes) {
+        for (size_t a = 0; a < archetypes_.size(); ++a) {
+            // Removing moves the entities to another archetype, so this shrinks
+            while (archetypes_[a].getMask().includes(compId) && archetypes_[a].getSize() > 0)
+                removeComponent(archetypes_[a].getEntity(archetypes_[a].getSize() - 1), compId);
+        }
+        return;
+    }
+
+    if (components_[compIndex].isTag()) {
+        for (size_t i = 0; i < entities_.size(); ++i) {
+            if (!entities_[i].allocated.includes(compId))
+                continue;
+            notify(compId, ComponentEvent::Remove, getEntityId(i));
+            entities_[i].allocated -= compId;
+            entities_[i].components -= compId;
+            updateQueries(getEntityId(i));
+        }
+        return;
+    }
+
+    auto& pool = *componentPools_[compIndex];
+    const auto& strct = components_[compIndex].getStruct();
+    size_t cursor = 0;
+    EntityId id(0);
+    while (pool.getNext(cursor, id)) {
+        id = getEntityId(getIndex(id));
+        notify(compId, ComponentEvent::Remove, id);
+        strct.free(pool.get(id));
+        auto& entity = entities_[getIndex(id)];
+        entity.components -= compId;
+        entity.allocated -= compId;
+        updateQueries(id);
+    }
+    pool.clear();
+}
+
+void World::setComponentEnabled(EntityId id, ComponentId compId, bool enabled)
+{
+    auto& components = entities_[getIndex(id)].components;
+    if (components.includes(compId) == enabled)
+        return;
+    if (enabled)
+        components += compId;
+    else
+        components -= compId;
+    updateQueries(id);
+    notify(compId, enabled ? ComponentEvent::Enable : ComponentEvent::Disable, id);
+}
+
+void World::setComponentDisabled(EntityId id, ComponentId compId)
+{
+    setComponentEnabled(id, compId, false);
+}
+
+bool World::isComponentAllocated(EntityId id, ComponentId compId)
+{
+    const auto& entity = entities_[getIndex(id)];
+    if (storage_ == Storage::Archetypes)
+        return archetypes_[entity.archetype].getMask().includes(compId);
+    return entity.allocated.includes(compId);
+}
+
+void* World::addComponentBuffer(EntityId id, ComponentId compId)
+{
+    const auto ptr = allocateComponent(id, compId);
+    components_[static_cast<size_t>(compId)].getStruct().init(ptr);
+    updateQueries(id);
+    notify(compId, ComponentEvent::Add, id);
+    return ptr;
+}
+
+void* World::allocateComponent(EntityId id, ComponentId compId)
+{
+    auto& entity = entities_[getIndex(id)];
+    entity.components += compId;
+    const auto tag = components_[static_cast<size_t>(compId)].isTag();
+    void* ptr = nullptr;
+    if (storage_ == Storage::Archetypes) {
+        assert(!isComponentAllocated(id, compId));
+        moveEntity(id, archetypes_[entity.archetype].getMask() + compId);
+        if (!tag)
+            ptr = archetypes_[entity.archetype].get(entity.row, compId);
+    } else {
+        assert(!entity.allocated.includes(compId));
+        entity.allocated += compId;
+        if (!tag)
+            ptr = componentPools_[static_cast<size_t>(compId)]->add(id);
+    }
+    markChanged(id, compId);
+    return ptr;
+}
+
+void World::setComponentData(EntityId id, ComponentId compId, void* ptr, const void* src)
+{
+    const auto& strct = components_[static_cast<size_t>(compId)].getStruct();
+    if (ptr) {
+        std::memcpy(ptr, src, strct.getSize());
+        return;
+    }
+    // SoA, scatter the fields into their columns
+    const auto& fields = strct.getFields();
+    for (size_t f = 0; f < fields.size(); ++f) {
+        std::memcpy(getFieldBuffer(id, compId, f),
+            reinterpret_cast<const uint8_t*>(src) + fields[f].offset, fields[f].size);
+    }
+}
+
+void World::addObserver(ComponentId compId, Observer observer, void* userData)
+{
+    observers_[static_cast<size_t>(compId)].push_back(ObserverEntry { observer, userData });
+}
+
+void World::removeObserver(ComponentId compId, Observer observer, void* userData)
+{
+    auto& observers = observers_[static_cast<size_t>(compId)];
+    observers.erase(std::remove_if(observers.begin(), observers.end(),
+                        [observer, userData](const ObserverEntry& entry) {
+                            return entry.observer == observer && entry.userData == userData;
+                        }),
+        observers.end());
+}
+
+void World::notify(ComponentId compId, ComponentEvent event, EntityId id)
 {
-    if (pageSize_ == 0)
-        pageSize_ = 1024 / componentSize; // ~1KB per page
+    for (const auto& entry : observers_[static_cast<size_t>(compId)])
+        entry.observer(entry.userData, event, id);
 }
 
-bool ComponentPool::has(EntityId entityId) const
+uint32_t World::getTick() const
 {
-    const auto [page, index] = getIndices(entityId);
-    return pages_.size() > page && pages_[page].occupied.test(index);
+    return tick_;
 }
 
-void* ComponentPool::add(EntityId entityId)
+void World::advanceTick()
 {
-    assert(!has(entityId));
-    const auto [page, index] = getIndices(entityId);
+    tick_++;
+}
 
-    if (page >= pages_.size()) {
-        const auto oldSize = pages_.size();
-        pages_.resize(page + 1);
-        for (size_t i = oldSize; i < pages_.size(); ++i)
-            pages_[i].occupied.resize(pageSize_);
+void World::markChanged(EntityId id, ComponentId compId)
+{
+    if (components_[static_cast<size_t>(compId)].isTag())
+        return;
+    if (storage_ == Storage::Archetypes) {
+        const auto& entity = entities_[getIndex(id)];
+        archetypes_[entity.archetype].setChanged(entity.row, compId, tick_);
+    } else {
+        componentPools_[static_cast<size_t>(compId)]->setChanged(id, tick_);
     }
+}
 
-    auto& pageObj = pages_[page];
-    if (!pageObj.data)
-        pageObj.data.reset(::operator new(pageSize_* componentSize_));
-    pageObj.occupied.set(index, true);
+uint32_t World::getChangeTick(EntityId id, ComponentId compId)
+{
+    assert(!components_[static_cast<size_t>(compId)].isTag() && "Tags have no change ticks");
+    if (storage_ == Storage::Archetypes) {
+        const auto& entity = entities_[getIndex(id)];
+        return archetypes_[entity.archetype].getChangeTick(entity.row, compId);
+    }
+    return componentPools_[static_cast<size_t>(compId)]->getChangeTick(id);
+}
 
-    auto ptr = getPointer(page, index);
-    std::memset(ptr, 0, componentSize_);
-    return ptr;
+void* World::getComponentBuffer(EntityId id, ComponentId compId)
+{
+    if (components_[static_cast<size_t>(compId)].isTag())
+        return nullptr;
+    if (storage_ == Storage::Archetypes) {
+        const auto& entity = entities_[getIndex(id)];
+        return archetypes_[entity.archetype].get(entity.row, compId);
+    }
+    return componentPools_[static_cast<size_t>(compId)]->get(id);
 }
 
-// No const overload, because you probably never have a const ComponentPool anyways
-void* ComponentPool::get(EntityId entityId)
+void* World::getFieldBuffer(EntityId id, ComponentId compId, size_t field)
 {
-    assert(has(entityId));
-    const auto [page, index] = getIndices(entityId);
-    return getPointer(page, index);
+    return getFieldColumnBuffer(id, compId, field).data;
 }
 
-void ComponentPool::remove(EntityId entityId)
+FieldColumn<void> World::getFieldColumnBuffer(EntityId id, ComponentId compId, size_t field)
 {
-    assert(has(entityId));
-    const auto [page, index] = getIndices(entityId);
-    auto& pageObj = pages_[page];
-    pageObj.occupied.set(index, false);
+    assert(isComponentAllocated(id, compId));
+    const auto& component = components_[static_cast<size_t>(compId)];
+    // Tags don't have any fields
+    assert(!component.isTag() && field < component.getStruct().getFields().size());
+    const auto& fieldObj = component.getStruct().getFields()[field];
+    assert(fieldObj.bit < 0);
+    auto& pool = *componentPools_[static_cast<size_t>(compId)];
+    if (storage_ == Storage::Pools && pool.hasColumns()) {
+        size_t count = 0;
+        const auto data = pool.getColumn(id, field, count);
+        return FieldColumn<void> { data, count };
+    }
+    const auto ptr = reinterpret_cast<uint8_t*>(getComponentBuffer(id, compId));
+    return FieldColumn<void> { ptr + fieldObj.offset, 1 };
+}
 
-    if (pageObj.occupied.none())
-        pageObj.data.reset();
+std::vector<Archetype>& World::getArchetypes()
+{
+    return archetypes_;
 }
 
-ComponentPool::Page::Page()
-    : data(nullptr, [](void* p) { ::operator delete(p); })
-    , occupied()
+size_t World::getArchetype(const ComponentMask& mask)
 {
+    const auto it = archetypeIndices_.find(mask);
+    if (it != archetypeIndices_.end())
+        return it->second;
+    archetypes_.emplace_back(mask, components_);
+    archetypeIndices_.emplace(mask, archetypes_.size() - 1);
+    return archetypes_.size() - 1;
 }
 
-std::pair<size_t, size_t> ComponentPool::getIndices(EntityId entityId) const
+bool World::IndexFreeList::empty() const
 {
-    const auto id = static_cast<size_t>(entityId);
-    return std::pair<size_t, size_t>(id / pageSize_, id % pageSize_);
+    return size_ == 0;
 }
 
-void* ComponentPool::getPointer(size_t page, size_t index)
+void World::IndexFreeList::push(size_t index)
 {
-    assert(pages_[page].data);
-    return reinterpret_cast<uint8_t*>(pages_[page].data.get()) + componentSize_ * index;
+    const auto word = index / 64;
+    if (word >= words_.size()) {
+        words_.resize(word + 1, 0);
+        nonEmptyWords_.resize(word / 64 + 1, 0);
+    }
+    assert(!(words_[word] & (1ull << (index % 64))));
+    words_[word] |= 1ull << (index % 64);
+    nonEmptyWords_[word / 64] |= 1ull << (word % 64);
+    firstNonEmpty_ = std::min(firstNonEmpty_, word / 64);
+    size_++;
+}
+
+size_t World::IndexFreeList::pop()
+{
+    assert(!empty());
+    // firstNonEmpty_ only moves forward here, so this is amortized O(1)
+    while (nonEmptyWords_[firstNonEmpty_] == 0)
+        firstNonEmpty_++;
+    const auto word = firstNonEmpty_ * 64 + countTrailingZeros(nonEmptyWords_[firstNonEmpty_]);
+    const auto index = word * 64 + countTrailingZeros(words_[word]);
+    words_[word] &= words_[word] - 1; // clear lowest bit
+    if (words_[word] == 0)
+        nonEmptyWords_[word / 64] &= ~(1ull << (word % 64));
+    size_--;
+    return index;
+}
+
+std::optional<size_t> World::IndexFreeList::popRange(size_t count)
+{
+    assert(count > 0);
+    if (size_ < count)
+        return std::nullopt;
+
+    // Walk the runs of set bits, skipping 64 empty words at a time
+    size_t runStart = 0;
+    size_t runLength = 0;
+    for (size_t word = firstNonEmpty_ * 64; word < words_.size() && runLength < count;) {
+        if (nonEmptyWords_[word / 64] == 0) {
+            runLength = 0;
+            word = (word / 64 + 1) * 64;
+            continue;
+        }
+        const auto bits = words_[word];
+        if (bits == ~0ull) {
+            if (runLength == 0)
+                runStart = word * 64;
+            runLength += 64;
+            ++word;
+            continue;
+        }
+        size_t bit = 0;
+        while (bit < 64 && runLength < count) {
+            const auto rest = bits >> bit;
+            if (rest & 1) {
+                // Not all bits are set and the ones shifted in are 0, so ~rest is never 0
+                const auto ones = std::min(countTrailingZeros(~rest), 64 - bit);
+                if (runLength == 0)
+                    runStart = word * 64 + bit;
+                runLength += ones;
+                bit += ones;
+            } else {
+                runLength = 0;
+                bit = rest == 0 ? 64 : bit + countTrailingZeros(rest);
+            }
+        }
+        ++word;
+    }
+    if (runLength < count)
+        return std::nullopt;
+
+    for (size_t index = runStart; index < runStart + count; ++index) {
+        const auto word = index / 64;
+        words_[word] &= ~(1ull << (index % 64));
+        if (words_[word] == 0)
+            nonEmptyWords_[word / 64] &= ~(1ull << (word % 64));
+    }
+    size_ -= count;
+    return runStart;
 }
 
-Component::Component(const std::string& name, Struct&& s)
-    : id_(ComponentId::getNew())
-    , name_(name)
-    , struct_(s)
+World::CommandBuffer::CommandBuffer(World* world)
+    : world_(world)
 {
 }
 
-ComponentId Component::getId() const
+World::CommandBuffer::~CommandBuffer()
 {
-    return id_;
+    // Staged components have been initialized, so they have to be freed
+    for (const auto& command : commands_) {
+        if (command.type == CommandType::AddComponent)
+            world_->getComponent(command.component).getStruct().free(command.data);
+    }
 }
 
-const std::string& Component::getName() const
+EntityId World::CommandBuffer::newEntity()
 {
-    return name_;
+    usedIds_++;
+    EntityId id(0);
+    if (reservedIds_.empty()) {
+        if (world_->commandBuffers_[0].get() == this && !world_->freeIndices_.empty()) {
+            // Only the main thread touches the free list, so its buffer can reserve lazily
+            id = world_->getEntityId(world_->freeIndices_.pop());
+        } else {
+            // Fresh ids have never been used, so they have generation 0
+            id = makeEntityId(world_->nextEntityId_++, 0);
+        }
+    } else {
+        id = reservedIds_.back();
+        reservedIds_.pop_back();
+    }
+    commands_.push_back(Command { CommandType::NewEntity, id, ComponentId(0), nullptr });
+    return id;
 }
 
-const Struct& Component::getStruct() const
+void World::CommandBuffer::destroyEntity(EntityId id)
 {
-    return struct_;
+    commands_.push_back(Command { CommandType::DestroyEntity, id, ComponentId(0), nullptr });
 }
 
-ComponentMask::ComponentMask(ComponentId id)
+void* World::CommandBuffer::addComponentBuffer(EntityId id, ComponentId compId)
 {
-    mask_.set(static_cast<size_t>(id), true);
+    const auto& strct = world_->getComponent(compId).getStruct();
+    const auto ptr = allocate(strct.getSize(), strct.getAlignment());
+    std::memset(ptr, 0, strct.getSize());
+    strct.init(ptr);
+    commands_.push_back(Command { CommandType::AddComponent, id, compId, ptr });
+    return ptr;
 }
 
-bool ComponentMask::includes(ComponentId id) const
+void World::CommandBuffer::removeComponent(EntityId id, ComponentId compId)
 {
-    return mask_.test(static_cast<size_t>(id));
+    commands_.push_back(Command { CommandType::RemoveComponent, id, compId, nullptr });
 }
 
-bool ComponentMask::includes(const ComponentMask& other) const
+void World::CommandBuffer::setComponentEnabled(EntityId id, ComponentId compId, bool enabled)
 {
-    return (mask_ & other.mask_) == other.mask_;
+    const auto type = enabled ? CommandType::EnableComponent : CommandType::DisableComponent;
+    commands_.push_back(Command { type, id, compId, nullptr });
 }
 
-// Returns true if none of the components in other are included in *this
-bool ComponentMask::includesNot(const ComponentMask& other) const
+bool World::CommandBuffer::isEmpty() const
 {
-    return (mask_ & other.mask_).none();
+    return commands_.empty();
 }
 
-void ComponentMask::add(ComponentId id)
+void* World::CommandBuffer::allocate(size_t size, size_t alignment)
 {
-    mask_.set(static_cast<size_t>(id), true);
+    assert(alignment <= alignof(std::max_align_t));
+    while (true) {
+        if (block_ < blocks_.size()) {
+            const auto offset = align(blockOffset_, alignment);
+            if (offset + size <= blocks_[block_].size) {
+                blockOffset_ = offset + size;
+                return blocks_[block_].data.get() + offset;
+            }
+            block_++;
+            blockOffset_ = 0;
+        } else {
+            const auto blockSize = std::max(minBlockSize, size);
+            blocks_.push_back(
+                Block { std::unique_ptr<uint8_t[]>(new uint8_t[blockSize]), blockSize });
+        }
+    }
 }
 
-void ComponentMask::remove(ComponentId id)
+void World::CommandBuffer::playback()
+{
+    auto& world = *world_;
+    for (const auto& command : commands_) {
+        const auto exists = world.entityExists(command.entity);
+        switch (command.type) {
+        case CommandType::NewEntity:
+            world.createEntity(command.entity);
+            break;
+        case CommandType::DestroyEntity:
+            if (exists)
+                world.destroyEntity(command.entity);
+            break;
+        case CommandType::AddComponent: {
+            const auto& strct = world.getComponent(command.component).getStruct();
+            if (!exists) {
+                strct.free(command.data);
+                break;
+            }
+            void* ptr = nullptr;
+            if (world.isComponentAllocated(command.entity, command.component)) {
+                // Replacing counts as removing and adding again for observers
+                world.notify(command.component, ComponentEvent::Remove, command.entity);
+                ptr = world.getComponentBuffer(command.entity, command.component);
+                strct.free(ptr);
+                world.entities_[getIndex(command.entity)].components
+                    += command.component;
+                world.markChanged(command.entity, command.component);
+            } else {
+                ptr = world.allocateComponent(command.entity, command.component);
+            }
+            // Components are trivially relocatable, so we can just move them
+            world.setComponentData(command.entity, command.component, ptr, command.data);
+            world.updateQueries(command.entity);
+            world.notify(command.component, ComponentEvent::Add, command.entity);
+            break;
+        }
+        case CommandType::RemoveComponent:
+            if (exists && world.isComponentAllocated(command.entity, command.component))
+                world.removeComponent(command.entity, command.component);
+            break;
+        case CommandType::EnableComponent:
+        case CommandType::DisableComponent:
+            if (exists && world.isComponentAllocated(command.entity, command.component))
+                world.setComponentEnabled(command.entity, command.component,
+                    command.type == CommandType::EnableComponent);
+            break;
+        }
+    }
+    commands_.clear();
+    block_ = 0;
+    blockOffset_ = 0;
+}
+
+void World::CommandBuffer::reserveIds()
+{
+    /* Reserve as many ids as were used since the last playback and give back the rest.
+     * Buffers that don't create entities shouldn't hold back the lowest free indices, because
+     * newEntity on the main thread would have to use higher ones, which spreads out the pools.
+     * The buffer of the main thread takes them from the free list when it needs them instead.
+     */
+    const auto count = world_->commandBuffers_[0].get() == this ? 0 : usedIds_;
+    usedIds_ = 0;
+    auto& freeIndices = world_->freeIndices_;
+    // Sorted in descending order, so newEntity takes the lowest and the highest are given back
+    if (reservedIds_.size() > count) {
+        const auto surplus = reservedIds_.size() - count;
+        for (size_t i = 0; i < surplus; ++i)
+            freeIndices.push(getIndex(reservedIds_[i]));
+        reservedIds_.erase(reservedIds_.begin(), reservedIds_.begin() + surplus);
+    }
+    while (reservedIds_.size() < count && !freeIndices.empty())
+        reservedIds_.push_back(world_->getEntityId(freeIndices.pop()));
+    std::sort(reservedIds_.begin(), reservedIds_.end(),
+        [](EntityId a, EntityId b) { return getIndex(a) > getIndex(b); });
+}
+
+World::CommandBuffer& World::getCommandBuffer()
 {
-    mask_.set(static_cast<size_t>(id), false);
+    const auto thread = ThreadPool::getCurrentThreadIndex();
+    if (commandBuffers_.empty()) {
+        // There is no thread pool yet, so this has to be the main thread
+        assert(thread == 0);
+        commandBuffers_.push_back(std::make_unique<CommandBuffer>(this));
+    }
+    assert(thread < commandBuffers_.size());
+    return *commandBuffers_[thread];
 }
 
-ComponentMask ComponentMask::operator+(ComponentId id) const
+void World::playbackCommands()
 {
-    ComponentMask mask(*this);
-    mask.mask_.set(static_cast<size_t>(id), true);
-    return mask;
+    for (auto& buffer : commandBuffers_)
+        buffer->playback();
+    // Reserve ids afterwards, so ids of entities destroyed during playback can be used
+    for (auto& buffer : commandBuffers_)
+        buffer->reserveIds();
 }
 
-ComponentMask ComponentMask::operator+(const ComponentMask& other) const
+void World::addSystem(System&& system)
 {
-    return ComponentMask(mask_ | other.mask_);
+    // This is kind of a hack to sort the internal systems vector of World,
+    // but for some things I want it to be sorted.
+    auto it = systems_.begin();
+    while (it != systems_.end() && it->name < system.name)
+        it++;
+    systems_.insert(it, std::move(system));
+
+    systemNames_.clear();
+    for (size_t i = 0; i < systems_.size(); ++i)
+        systemNames_.emplace(systems_[i].name, i);
+    // It refers to systems by index
+    timeline_.clear();
 }
 
-ComponentMask& ComponentMask::operator+=(ComponentId id)
+void World::runSystem(System& system, float dt)
 {
-    add(id);
-    return *this;
+    if (system.enabled) {
+        const auto start = getTime();
+        system.function(dt);
+        system.lastDuration = getTime() - start;
+    }
 }
 
-ComponentMask& ComponentMask::operator-=(ComponentId id)
+ThreadPool& World::getThreadPool()
 {
-    remove(id);
-    return *this;
+    if (!threadPool_) {
+        threadPool_ = std::make_unique<ThreadPool>(workerCount_);
+        while (commandBuffers_.size() < threadPool_->getThreadCount() + 1)
+            commandBuffers_.push_back(std::make_unique<CommandBuffer>(this));
+    }
+    return *threadPool_;
+}
+
+void World::moveEntity(EntityId id, const ComponentMask& mask)
+{
+    auto& entity = entities_[getIndex(id)];
+    const auto srcIndex = entity.archetype;
+    const auto dstIndex = getArchetype(mask);
+    // getArchetype might have reallocated archetypes_, so get references afterwards
+    auto& src = archetypes_[srcIndex];
+    auto& dst = archetypes_[dstIndex];
+    const auto srcRow = entity.row;
+    const auto dstRow = dst.add(id);
+    // Components are trivially relocatable (they may not point into themselves)
+    for (const auto& component : components_) {
+        const auto compId = component.getId();
+        if (src.hasColumn(compId) && dst.hasColumn(compId)) {
+            std::memcpy(
+                dst.get(dstRow, compId), src.get(srcRow, compId), component.getStruct().getSize());
+            dst.setChanged(dstRow, compId, src.getChangeTick(srcRow, compId));
+        }
+    }
+    const auto moved = src.remove(srcRow);
+    if (moved)
+        entities_[getIndex(*moved)].row = srcRow;
+    entity.archetype = dstIndex;
+    entity.row = dstRow;
 }
 
-void ComponentMask::clear()
+ComponentId World::getComponentId(const std::string& name) const
 {
-    mask_.reset();
+    return componentNames_.at(name);
 }
 
-auto ComponentMask::getMask() const
+std::optional<ComponentId> World::findComponentId(const std::string& name) const
 {
-    return mask_;
+    const auto it = componentNames_.find(name);
+    if (it == componentNames_.end())
+        return std::nullopt;
+    return it->second;
 }
 
-ComponentMask::ComponentMask(const std::bitset<maxComponents>& mask)
-    : mask_(mask)
+World::EntityIterator::EntityIterator(
+    World* world, const ComponentMask& mask, const std::optional<ChangeFilter>& changed)
+    : world_(world)
+    , mask_(mask)
+    , changed_(changed)
+    , id_(maxId<EntityId>())
 {
+    if (changed_) {
+        assert(!world_->components_[static_cast<size_t>(changed_->component)].isTag());
+        mask_ += changed_->component;
+    }
+    if (world_->storage_ == Storage::Pools && changed_) {
+        driver_ = world_->componentPools_[static_cast<size_t>(changed_->component)].get();
+    } else if (world_->storage_ == Storage::Pools) {
+        // Pick the pool with the fewest components to drive the iteration
+        for (size_t compId = 0; compId < world_->componentPools_.size(); ++compId) {
+            // Tags don't have a pool, so with only tags in the mask all entities are checked
+            const auto pool = world_->componentPools_[compId].get();
+            if (pool && mask_.includes(ComponentId(compId))
+                && (!driver_ || pool->getSize() < driver_->getSize()))
+                driver_ = pool;
+        }
+    }
+    findNext();
 }
 
-ComponentMask operator+(ComponentId a, ComponentId b)
+World::EntityIterator& World::EntityIterator::operator++()
 {
-    ComponentMask mask;
-    mask.add(a);
-    mask.add(b);
-    return mask;
+    if (world_->storage_ == Storage::Archetypes || !driver_)
+        index_++;
+    findNext();
+    return *this;
 }
 
-World::~World()
+bool World::EntityIterator::operator==(Sentinel) const
 {
-    // We just have to make sure we call Struct::free here, because the componentPool
-    // can't do that itself. The actual freeing is however still done by the pool.
-    for (size_t compId = 0; compId < components_.size(); ++compId) {
-        auto& pool = componentPools_[compId];
-        auto& strct = components_[compId].getStruct();
-        for (size_t id = 0; id < entities_.size(); ++id) {
-            if (pool.has(EntityId(id)))
-                strct.free(pool.get(EntityId(id)));
+    return end_;
+}
+
+bool World::EntityIterator::operator!=(Sentinel sentinel) const
+{
+    return !(*this == sentinel);
+}
+
+void* World::EntityIterator::getComponent(ComponentId compId) const
+{
+    // Like World::getComponentBuffer
+    if (world_->components_[static_cast<size_t>(compId)].isTag())
+        return nullptr;
+    if (world_->storage_ == Storage::Archetypes)
+        return world_->archetypes_[archetype_].get(chunk_, index_, compId);
+    return world_->componentPools_[static_cast<size_t>(compId)]->get(id_);
+}
+
+std::vector<World::EntityIterator> World::EntityIterator::split() const
+{
+    // Every part should at least be worth pushing to another thread
+    constexpr size_t minPartSize = 1024;
+    std::vector<EntityIterator> parts;
+    const auto addPart = [this, &parts](size_t archetype, size_t chunk, size_t begin,
+                             size_t limit) {
+        auto it = *this;
+        it.end_ = false;
+        it.archetype_ = archetype;
+        it.chunk_ = chunk;
+        it.cursor_ = begin;
+        it.index_ = it.driver_ ? 0 : begin;
+        it.limit_ = limit;
+        it.singleChunk_ = world_->storage_ == Storage::Archetypes;
+        it.findNext();
+        if (!it.end_)
+            parts.push_back(it);
+    };
+
+    if (world_->storage_ == Storage::Archetypes) {
+        const auto& archetypes = world_->archetypes_;
+        for (size_t a = 0; a < archetypes.size(); ++a) {
+            if (archetypes[a].getMask().includes(mask_)) {
+                for (size_t c = 0; c < archetypes[a].getChunkCount(); ++c)
+                    addPart(a, c, 0, limit_);
+            }
+        }
+        return parts;
+    }
+
+    const auto end = driver_ ? driver_->getCursorEnd() : world_->entities_.size();
+    const auto granularity = driver_ ? driver_->getCursorGranularity() : 1;
+    const auto step = (minPartSize + granularity - 1) / granularity * granularity;
+    for (size_t begin = 0; begin < end; begin += step)
+        addPart(0, 0, begin, begin + step);
+    return parts;
+}
+
+void World::EntityIterator::findNext()
+{
+    const auto& entities = world_->entities_;
+    if (world_->storage_ == Storage::Archetypes) {
+        // Only walk the archetypes that have all the components and then the entities
+        // in them, which have all of them enabled.
+        const auto& archetypes = world_->archetypes_;
+        for (; archetype_ < archetypes.size(); ++archetype_) {
+            const auto& archetype = archetypes[archetype_];
+            if (archetype.getMask().includes(mask_)) {
+                for (; chunk_ < archetype.getChunkCount(); ++chunk_) {
+                    const auto size = archetype.getChunkSize(chunk_);
+                    const auto chunkEntities = archetype.getChunkEntities(chunk_);
+                    const uint32_t* ticks = nullptr;
+                    if (changed_) {
+                        if (archetype.getChunkChangeTick(chunk_, changed_->component)
+                            < changed_->tick)
+                            index_ = size; // skip the whole chunk
+                        else
+                            ticks = archetype.getChunkChangeTicks(chunk_, changed_->component);
+                    }
+                    for (; index_ < size; ++index_) {
+                        id_ = chunkEntities[index_];
+                        if ((!ticks || ticks[index_] >= changed_->tick)
+                            && entities[getIndex(id_)].components.includes(mask_))
+                            return;
+                    }
+                    index_ = 0;
+                    if (singleChunk_)
+                        break;
+                }
+            }
+            if (singleChunk_)
+                break;
+            chunk_ = 0;
+            index_ = 0;
+        }
+        end_ = true;
+        return;
+    }
+
+    if (driver_) {
+        // The pool might contain disabled components, so we still have to check the mask
+        // The pool stops at limit_ itself, so a part doesn't scan the rest of the pool
+        const auto next = [this]() {
+            return changed_ ? driver_->getNextChanged(cursor_, id_, changed_->tick, limit_)
+                            : driver_->getNext(cursor_, id_, limit_);
+        };
+        while (next()) {
+            if (entities[getIndex(id_)].components.includes(mask_)) {
+                id_ = world_->getEntityId(getIndex(id_));
+                return;
+            }
+        }
+        end_ = true;
+        return;
+    }
+
+    for (; index_ < std::min(entities.size(), limit_); ++index_) {
+        const auto& entity = entities[index_];
+        if (entity.exists && entity.components.includes(mask_)) {
+            id_ = world_->getEntityId(index_);
+            return;
         }
     }
+    end_ = true;
 }
 
-const std::vector<Component>& World::getComponents()
+World::Range<World::EntityIterator> World::foreachEntity(const ComponentMask& mask)
 {
-    return components_;
+    return EntityIterator(this, mask);
 }
 
-bool World::entityExists(EntityId id) const
+World::Range<World::EntityIterator> World::foreachEntity(
+    const ComponentMask& mask, const ChangeFilter& changed)
 {
-    const auto idx = static_cast<size_t>(id);
-    return idx < entities_.size() && entities_[idx].exists;
+    return EntityIterator(this, mask, changed);
 }
 
-EntityId World::newEntity()
+World::QueryIterator::QueryIterator(World* world, QueryId query)
+    : world_(world)
+    , query_(static_cast<size_t>(query))
+    , index_(world->queries_[query_].members.size())
 {
-    if (entityIdFreeList_.empty()) {
-        entities_.push_back(Entity { true, ComponentMask() });
-        return EntityId(entities_.size() - 1);
-    } else {
-        const auto id = entityIdFreeList_.top();
-        entityIdFreeList_.pop();
-        const auto idx = static_cast<size_t>(id);
-        assert(idx < entities_.size());
-        entities_[idx].exists = true;
-        entities_[idx].components.clear();
-        return id;
+    assert(world_->queries_[query_].active);
+}
+
+World::QueryIterator& World::QueryIterator::operator++()
+{
+    index_--;
+    // If the current and the following members were removed, we have to skip ahead
+    index_ = std::min(index_, world_->queries_[query_].members.size());
+    return *this;
+}
+
+bool World::QueryIterator::operator==(Sentinel) const
+{
+    return index_ <= begin_;
+}
+
+bool World::QueryIterator::operator!=(Sentinel sentinel) const
+{
+    return !(*this == sentinel);
+}
+
+void* World::QueryIterator::getComponent(ComponentId compId) const
+{
+    return world_->getComponentBuffer(**this, compId);
+}
+
+std::vector<World::QueryIterator> World::QueryIterator::split() const
+{
+    constexpr size_t partSize = 1024;
+    std::vector<QueryIterator> parts;
+    const auto size = world_->queries_[query_].members.size();
+    for (size_t begin = 0; begin < size; begin += partSize) {
+        auto it = *this;
+        it.begin_ = begin;
+        it.index_ = std::min(begin + partSize, size);
+        parts.push_back(it);
     }
+    return parts;
 }
 
-void World::destroyEntity(EntityId id)
+QueryId World::registerQuery(const ComponentMask& include, const ComponentMask& exclude)
 {
-    const auto idx = static_cast<size_t>(id);
-    assert(entityExists(id));
-    for (size_t compId = 0; compId < componentPools_.size(); ++compId) {
-        if (entities_[idx].components.includes(ComponentId(compId))) {
-            componentPools_[compId].remove(id);
-        }
+    auto it = std::find_if(
+        queries_.begin(), queries_.end(), [](const Query& query) { return !query.active; });
+    if (it == queries_.end()) {
+        queries_.emplace_back();
+        it = queries_.end() - 1;
+    }
+    *it = Query { true, include, exclude, {}, {} };
+    for (const auto id : foreachEntity(include)) {
+        if (it->matches(entities_[getIndex(id)]))
+            it->add(id);
     }
-    entities_[idx].exists = false;
-    entityIdFreeList_.push(id);
+    return QueryId(it - queries_.begin());
 }
 
-bool World::hasComponent(EntityId id, ComponentId compId)
+void World::unregisterQuery(QueryId query)
 {
-    assert(entityExists(id));
-    return entities_[static_cast<size_t>(id)].components.includes(compId);
+    auto& q = queries_[static_cast<size_t>(query)];
+    q.active = false;
+    q.members = std::vector<EntityId>();
+    q.indices = std::vector<uint32_t>();
 }
 
-void World::removeComponent(EntityId id, ComponentId compId)
+World::Range<World::QueryIterator> World::foreachEntity(QueryId query)
 {
-    // This does not assert hasComponent, because we might remove a disabled component
-    // If there isn't even a disabled component the ComponentPool::get will abort
-    const auto compIndex = static_cast<size_t>(compId);
-    auto ptr = componentPools_[compIndex].get(id);
-    components_[compIndex].getStruct().free(ptr);
-    entities_[static_cast<size_t>(id)].components -= compId;
-    componentPools_[compIndex].remove(id);
+    return QueryIterator(this, query);
 }
 
-void World::setComponentEnabled(EntityId id, ComponentId compId, bool enabled)
+size_t World::getQuerySize(QueryId query) const
 {
-    if (enabled)
-        entities_[static_cast<size_t>(id)].components += compId;
-    else
-        entities_[static_cast<size_t>(id)].components -= compId;
+    return queries_[static_cast<size_t>(query)].members.size();
 }
 
-void World::setComponentDisabled(EntityId id, ComponentId compId)
+bool World::Query::matches(const Entity& entity) const
 {
-    setComponentEnabled(id, compId, false);
+    return entity.exists && entity.components.includes(include)
+        && entity.components.includesNot(exclude);
 }
 
-bool World::isComponentAllocated(EntityId id, ComponentId compId)
+bool World::Query::isMember(EntityId id) const
 {
-    return componentPools_[static_cast<size_t>(compId)].has(id);
+    const auto idx = getIndex(id);
+    return idx < indices.size() && indices[idx] != noIndex;
 }
 
-void* World::getComponentBuffer(EntityId id, ComponentId compId)
+void World::Query::add(EntityId id)
 {
-    return componentPools_[static_cast<size_t>(compId)].get(id);
+    const auto idx = getIndex(id);
+    if (idx >= indices.size())
+        indices.resize(idx + 1, noIndex);
+    assert(members.size() < noIndex);
+    indices[idx] = static_cast<uint32_t>(members.size());
+    members.push_back(id);
 }
 
-ComponentId World::getComponentId(const std::string& name) const
+void World::Query::remove(EntityId id)
 {
-    return componentNames_.at(name);
+    const auto idx = getIndex(id);
+    const auto index = indices[idx];
+    members[index] = members.back();
+    indices[getIndex(members[index])] = index;
+    members.pop_back();
+    indices[idx] = noIndex;
 }
 
-// Implement foreachEntity in the future that returns a custom iterator.
-std::vector<EntityId> World::getEntities(const ComponentMask& mask) const
+void World::updateQueries(EntityId id)
 {
-    std::vector<EntityId> ids;
-    for (size_t id = 0; id < entities_.size(); ++id) {
-        auto& entity = entities_[id];
-        if (entity.exists && entity.components.includes(mask))
-            ids.push_back(EntityId(id));
+    const auto& entity = entities_[getIndex(id)];
+    for (auto& query : queries_) {
+        if (!query.active)
+            continue;
+        const auto matches = query.matches(entity);
+        if (matches != query.isMember(id)) {
+            if (matches)
+                query.add(id);
+            else
+                query.remove(id);
+        }
     }
+}
+
+std::vector<EntityId> World::getEntities(const ComponentMask& mask)
+{
+    std::vector<EntityId> ids;
+    for (const auto id : foreachEntity(mask))
+        ids.push_back(id);
     return ids;
 }
 
-void World::registerComponent(const std::string& name, Struct&& strct)
+void World::registerComponent(const std::string& name, Struct&& strct,
+    ComponentPool::Type poolType, ComponentPool::Options options)
 {
     // Component names must be unique
     assert(std::all_of(components_.begin(), components_.end(),
         [&name](const Component& c) { return name != c.getName(); }));
-    components_.emplace_back(name, std::forward<Struct>(strct));
+    options.alignment = std::max(options.alignment, strct.getAlignment());
+    components_.emplace_back(name, std::forward<Struct>(strct), options.alignment);
 
     const Component& component = components_.back();
     // This whole design is horrible, because it assumes all components are registered
     // in the world.
     assert(static_cast<size_t>(component.getId()) == components_.size() - 1);
     // TODO: Page size has to be configurable at some point.
-    componentPools_.emplace_back(component.getStruct().getSize());
+    const auto& componentStruct = component.getStruct();
+    if (poolType == ComponentPool::Type::Soa) {
+        assert(componentStruct.isTrivial() && "SoA components can't have strings, etc.");
+        options.columnSizes.clear();
+        for (const auto& field : componentStruct.getFields()) {
+            assert(field.bit < 0 && "SoA components can't have packed bools");
+            options.columnSizes.push_back(field.size);
+        }
+    }
+    if (!componentStruct.isTrivial())
+        nonTrivial_ += component.getId();
+    if (component.isTag())
+        componentPools_.push_back(nullptr);
+    else
+        componentPools_.push_back(
+            ComponentPool::create(poolType, componentStruct.getSize(), options));
+    observers_.emplace_back();
     componentNames_.emplace(component.getName(), component.getId());
     componentRegistered(component);
 }
@@ -310,8 +1860,11 @@ void World::registerComponent(const std::string& name, Struct&& strct)
 void World::unregisterSystem(const std::string& name)
 {
     systems_.erase(std::remove_if(systems_.begin(), systems_.end(),
-        [&name](const System& system) { return system.name == name; }));
-    systemNames_.erase(name);
+                       [&name](const System& system) { return system.name == name; }),
+        systems_.end());
+    systemNames_.clear();
+    for (size_t i = 0; i < systems_.size(); ++i)
+        systemNames_.emplace(systems_[i].name, i);
 }
 
 const Component& World::getComponent(ComponentId compId) const
@@ -321,12 +1874,113 @@ const Component& World::getComponent(ComponentId compId) const
 
 void World::invokeSystem(const std::string& name, float dt)
 {
-    auto& system = systems_[systemNames_.at(name)];
-    if (system.enabled) {
+    runSystem(systems_[systemNames_.at(name)], dt);
+}
+
+void World::invokeSystems(const std::vector<std::string>& names, float dt)
+{
+    // Every system depends on all systems before it that it conflicts with
+    const auto count = names.size();
+    std::vector<size_t> systems(count);
+    std::vector<std::vector<size_t>> dependents(count);
+    std::vector<size_t> dependencyCount(count, 0);
+    bool parallel = false;
+    for (size_t i = 0; i < count; ++i) {
+        systems[i] = systemNames_.at(names[i]);
+        const auto& access = systems_[systems[i]].access;
+        parallel = parallel || access;
+        for (size_t j = 0; j < i; ++j) {
+            const auto& otherAccess = systems_[systems[j]].access;
+            if (!access || !otherAccess || access->conflicts(*otherAccess)) {
+                dependents[j].push_back(i);
+                dependencyCount[i]++;
+            }
+        }
+    }
+
+    advanceTick();
+    timeline_.clear();
+    std::mutex mutex;
+    std::condition_variable condition;
+    std::vector<size_t> finished; // filled by the workers
+    std::deque<size_t> mainThreadQueue;
+
+    auto run = [this, &systems, dt, &mutex](size_t index, size_t thread) {
+        auto& system = systems_[systems[index]];
         const auto start = getTime();
-        system.function(dt);
-        system.lastDuration = getTime() - start;
+        runSystem(system, dt);
+        std::lock_guard<std::mutex> lock(mutex);
+        if (system.enabled)
+            timeline_.push_back(TimelineEntry { systems[index], thread, start, getTime() });
+    };
+
+    auto schedule = [&](size_t index) {
+        if (!parallel || !systems_[systems[index]].access) {
+            mainThreadQueue.push_back(index);
+            return;
+        }
+        getThreadPool().push([&, index](size_t thread) {
+            run(index, thread);
+            std::lock_guard<std::mutex> lock(mutex);
+            finished.push_back(index);
+            condition.notify_one();
+        });
+    };
+
+    for (size_t i = 0; i < count; ++i) {
+        if (dependencyCount[i] == 0)
+            schedule(i);
     }
+
+    size_t done = 0;
+    std::vector<size_t> justFinished;
+    while (done < count) {
+        justFinished.clear();
+        if (!mainThreadQueue.empty()) {
+            // Nothing else is running right now
+            playbackCommands();
+            justFinished.push_back(mainThreadQueue.front());
+            mainThreadQueue.pop_front();
+            run(justFinished.back(), 0);
+        } else {
+            std::unique_lock<std::mutex> lock(mutex);
+            condition.wait(lock, [&finished]() { return !finished.empty(); });
+            justFinished.swap(finished);
+        }
+
+        for (const auto index : justFinished) {
+            done++;
+            for (const auto dependent : dependents[index]) {
+                if (--dependencyCount[dependent] == 0)
+                    schedule(dependent);
+            }
+        }
+    }
+    playbackCommands();
+}
+
+void World::releaseReservedIds()
+{
+    for (const auto& buffer : commandBuffers_) {
+        for (const auto id : buffer->reservedIds_)
+            freeIndices_.push(getIndex(id));
+        buffer->reservedIds_.clear();
+    }
+}
+
+void World::setWorkerCount(size_t count)
+{
+    // The number of command buffers changes, so give back the reserved ids
+    playbackCommands();
+    releaseReservedIds();
+    commandBuffers_.clear();
+    workerCount_ = count;
+    threadPool_.reset();
+}
+
+const std::vector<World::TimelineEntry>& World::getTimeline() const
+{
+    return timeline_;
 }
 
 std::vector<World::System>& World::getSystems()
@@ -355,24 +2009,92 @@ bool entityExists(EntityId id)
     return getDefaultWorld().entityExists(id);
 }
 
+void reserveEntities(size_t count)
+{
+    getDefaultWorld().reserveEntities(count);
+}
+
 EntityId newEntity()
 {
     return getDefaultWorld().newEntity();
 }
 
+EntityId newEntities(size_t count, const ComponentMask& mask)
+{
+    return getDefaultWorld().newEntities(count, mask);
+}
+
 void destroyEntity(EntityId id)
 {
     getDefaultWorld().destroyEntity(id);
 }
 
+void destroyEntities(const EntityId* ids, size_t count)
+{
+    getDefaultWorld().destroyEntities(ids, count);
+}
+
+void destroyEntities(const std::vector<EntityId>& ids)
+{
+    getDefaultWorld().destroyEntities(ids);
+}
+
+void destroyAllEntities(bool freeFields)
+{
+    getDefaultWorld().destroyAllEntities(freeFields);
+}
+
+void beginFieldArena()
+{
+    getDefaultWorld().beginFieldArena();
+}
+
+void endFieldArena()
+{
+    getDefaultWorld().endFieldArena();
+}
+
+EntityRemap compact(const std::function<uint64_t(EntityId)>& sortKey)
+{
+    return getDefaultWorld().compact(sortKey);
+}
+
+World::Range<World::EntityIterator> foreachEntity(const ComponentMask& mask)
+{
+    return getDefaultWorld().foreachEntity(mask);
+}
+
+QueryId registerQuery(const ComponentMask& include, const ComponentMask& exclude)
+{
+    return getDefaultWorld().registerQuery(include, exclude);
+}
+
+void unregisterQuery(QueryId query)
+{
+    getDefaultWorld().unregisterQuery(query);
+}
+
+World::Range<World::EntityIterator> foreachEntity(
+    const ComponentMask& mask, const ChangeFilter& changed)
+{
+    return getDefaultWorld().foreachEntity(mask, changed);
+}
+
+World::Range<World::QueryIterator> foreachEntity(QueryId query)
+{
+    return getDefaultWorld().foreachEntity(query);
+}
+
 std::vector<EntityId> getEntities(const ComponentMask& mask)
 {
     return getDefaultWorld().getEntities(mask);
 }
 
-void registerComponent(const std::string& name, Struct&& strct)
+void registerComponent(const std::string& name, Struct&& strct, ComponentPool::Type poolType,
+    ComponentPool::Options options)
 {
-    getDefaultWorld().registerComponent(name, std::forward<Struct>(strct));
+    getDefaultWorld().registerComponent(
+        name, std::forward<Struct>(strct), poolType, std::move(options));
 }
 
 const Component& getComponent(ComponentId compId)
@@ -390,11 +2112,51 @@ bool hasComponent(EntityId id, ComponentId compId)
     return getDefaultWorld().hasComponent(id, compId);
 }
 
+uint32_t getTick()
+{
+    return getDefaultWorld().getTick();
+}
+
+void advanceTick()
+{
+    getDefaultWorld().advanceTick();
+}
+
+void markChanged(EntityId id, ComponentId compId)
+{
+    getDefaultWorld().markChanged(id, compId);
+}
+
+uint32_t getChangeTick(EntityId id, ComponentId compId)
+{
+    return getDefaultWorld().getChangeTick(id, compId);
+}
+
 void removeComponent(EntityId id, ComponentId compId)
 {
     getDefaultWorld().removeComponent(id, compId);
 }
 
+void clearComponent(ComponentId compId)
+{
+    getDefaultWorld().clearComponent(compId);
+}
+
+void registerPrefab(const std::string& name, Prefab&& prefab)
+{
+    getDefaultWorld().registerPrefab(name, std::move(prefab));
+}
+
+bool hasPrefab(const std::string& name)
+{
+    return getDefaultWorld().hasPrefab(name);
+}
+
+Prefab& getPrefab(const std::string& name)
+{
+    return getDefaultWorld().getPrefab(name);
+}
+
 void setComponentEnabled(EntityId id, ComponentId compId, bool enabled)
 {
     getDefaultWorld().setComponentEnabled(id, compId, enabled);
@@ -415,6 +2177,16 @@ void* getComponentBuffer(EntityId id, ComponentId compId)
     return getDefaultWorld().getComponentBuffer(id, compId);
 }
 
+void* getFieldBuffer(EntityId id, ComponentId compId, size_t field)
+{
+    return getDefaultWorld().getFieldBuffer(id, compId, field);
+}
+
+FieldColumn<void> getFieldColumnBuffer(EntityId id, ComponentId compId, size_t field)
+{
+    return getDefaultWorld().getFieldColumnBuffer(id, compId, field);
+}
+
 ComponentId getComponentId(const std::string& name)
 {
     return getDefaultWorld().getComponentId(name);
@@ -430,11 +2202,31 @@ void invokeSystem(const std::string& name, float dt)
     return getDefaultWorld().invokeSystem(name, dt);
 }
 
+void invokeSystems(const std::vector<std::string>& names, float dt)
+{
+    getDefaultWorld().invokeSystems(names, dt);
+}
+
+const std::vector<World::TimelineEntry>& getTimeline()
+{
+    return getDefaultWorld().getTimeline();
+}
+
 std::vector<World::System>& getSystems()
 {
     return getDefaultWorld().getSystems();
 }
 
+World::CommandBuffer& getCommandBuffer()
+{
+    return getDefaultWorld().getCommandBuffer();
+}
+
+void playbackCommands()
+{
+    getDefaultWorld().playbackCommands();
+}
+
 void setSystemEnabled(const std::string& name, bool enabled)
 {
     getDefaultWorld().setSystemEnabled(name, enabled);
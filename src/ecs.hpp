@@ -1,8 +1,14 @@
 #pragma once
 
-#include <bitset>
+#include <array>
+#include <atomic>
 #include <cstdint>
-#include <queue>
+#include <functional>
+#include <limits>
+#include <optional>
+#include <tuple>
+#include <type_traits>
+#include <unordered_map>
 #include <utility>
 #include <vector>
 
@@ -10,70 +16,111 @@
 #include <boost/dynamic_bitset.hpp>
 #include <boost/signals2.hpp>
 
+#include "allocator.hpp"
+#include "componentpool.hpp"
 #include "id.hpp"
 #include "struct.hpp"
+#include "threadpool.hpp"
+#include "util.hpp"
 
-namespace myl {
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define MYL_MASK_SSE2
+#endif
 
-struct EntityIdTag {
-};
-using EntityId = Id<EntityIdTag, size_t>;
+// Can be set with cmake -DMYL_MAX_COMPONENTS=256
+#ifndef MYL_MAX_COMPONENTS
+#define MYL_MAX_COMPONENTS 64
+#endif
 
-constexpr auto maxComponents = 64;
+namespace myl {
+
+constexpr size_t maxComponents = MYL_MAX_COMPONENTS;
+static_assert(maxComponents % 64 == 0, "MYL_MAX_COMPONENTS has to be a multiple of 64");
 struct ComponentIdTag {
 };
 using ComponentId = Id<ComponentIdTag, size_t, maxComponents>;
 
-class ComponentPool {
-public:
-    ComponentPool(size_t componentSize, size_t pageSize = 0);
-
-    bool has(EntityId entityId) const;
-    void* add(EntityId entityId);
-    // No const overload, because you probably never have a const ComponentPool anyways
-    void* get(EntityId entityId);
-    void remove(EntityId entityId);
-
-private:
-    struct Page {
-        std::unique_ptr<void, void (*)(void*)> data;
-        boost::dynamic_bitset<> occupied;
-
-        Page();
-    };
-
-    std::pair<size_t, size_t> getIndices(EntityId entityId) const;
-    void* getPointer(size_t page, size_t index);
-
-    size_t componentSize_;
-    size_t pageSize_;
-    std::vector<Page> pages_;
+struct QueryIdTag {
 };
+using QueryId = Id<QueryIdTag, size_t>;
 
 class Component {
 public:
-    Component(const std::string& name, Struct&& s);
+    Component(const std::string& name, Struct&& s, size_t alignment = 1);
 
     ComponentId getId() const;
     const std::string& getName() const;
     const Struct& getStruct() const;
+    // The alignment in the pool, which is at least the alignment of the struct
+    size_t getAlignment() const;
+
+    /*
+     * Components without fields are tags. They only exist as a bit in the ComponentMask of
+     * the entity (and of the archetype), so they have no ComponentPool or column, no change
+     * ticks and getComponent returns nullptr for them.
+     */
+    bool isTag() const;
 
 private:
     ComponentId id_;
     std::string name_;
     Struct struct_;
+    size_t alignment_;
 };
 
+/*
+ * A fixed-size bitset of maxComponents bits. includes and includesNot are evaluated for all
+ * words without branching (with SSE2 two words at a time), because they are called for
+ * every entity or archetype in a scan, so wider masks only cost a few more instructions.
+ */
 class ComponentMask {
 public:
+    static constexpr size_t wordCount = maxComponents / 64;
+    using Words = std::array<uint64_t, wordCount>;
+
     ComponentMask() = default;
     ComponentMask(ComponentId id);
 
-    bool includes(ComponentId id) const;
-    bool includes(const ComponentMask& other) const;
+    bool includes(ComponentId id) const
+    {
+        const auto idx = static_cast<size_t>(id);
+        return words_[idx / 64] & (1ull << (idx % 64));
+    }
+
+    bool includes(const ComponentMask& other) const
+    {
+        // Every bit in other that is not in *this
+#ifdef MYL_MASK_SSE2
+        if constexpr (wordCount % 2 == 0) {
+            auto acc = _mm_setzero_si128();
+            for (size_t i = 0; i < wordCount; i += 2)
+                acc = _mm_or_si128(acc, _mm_andnot_si128(load(i), other.load(i)));
+            return isZero(acc);
+        }
+#endif
+        uint64_t acc = 0;
+        for (size_t i = 0; i < wordCount; ++i)
+            acc |= other.words_[i] & ~words_[i];
+        return acc == 0;
+    }
 
     // Returns true if none of the components in other are included in *this
-    bool includesNot(const ComponentMask& other) const;
+    bool includesNot(const ComponentMask& other) const
+    {
+#ifdef MYL_MASK_SSE2
+        if constexpr (wordCount % 2 == 0) {
+            auto acc = _mm_setzero_si128();
+            for (size_t i = 0; i < wordCount; i += 2)
+                acc = _mm_or_si128(acc, _mm_and_si128(load(i), other.load(i)));
+            return isZero(acc);
+        }
+#endif
+        uint64_t acc = 0;
+        for (size_t i = 0; i < wordCount; ++i)
+            acc |= other.words_[i] & words_[i];
+        return acc == 0;
+    }
 
     void add(ComponentId id);
     void remove(ComponentId id);
@@ -86,21 +133,205 @@ public:
 
     void clear();
 
-    auto getMask() const;
+    // Calls func(ComponentId) for every component in the mask
+    template <typename Func>
+    void forEach(Func&& func) const
+    {
+        for (size_t w = 0; w < wordCount; ++w) {
+            for (auto word = words_[w]; word; word &= word - 1)
+                func(ComponentId(w * 64 + countTrailingZeros(word)));
+        }
+    }
+
+    const Words& getMask() const;
+
+    bool operator==(const ComponentMask& other) const;
+    bool operator!=(const ComponentMask& other) const;
+
+    struct Hash {
+        size_t operator()(const ComponentMask& mask) const;
+    };
 
 private:
-    ComponentMask(const std::bitset<maxComponents>& mask);
+#ifdef MYL_MASK_SSE2
+    __m128i load(size_t word) const
+    {
+        return _mm_load_si128(reinterpret_cast<const __m128i*>(words_.data() + word));
+    }
+
+    static bool isZero(__m128i v)
+    {
+        return _mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_setzero_si128())) == 0xffff;
+    }
+#endif
 
-    std::bitset<maxComponents> mask_;
+    alignas(16) Words words_ {};
 };
 
 ComponentMask operator+(ComponentId a, ComponentId b);
 
+// Which components a system reads and writes, so it can be scheduled in parallel
+struct ComponentAccess {
+    ComponentMask reads;
+    ComponentMask writes;
+
+    bool conflicts(const ComponentAccess& other) const;
+};
+
+// Only entities whose component was changed at or after tick (see World::getTick)
+struct ChangeFilter {
+    ComponentId component;
+    uint32_t tick;
+};
+
+// The values of one field for the entity ids id, id + 1, ..., id + count - 1 (see
+// World::getFieldColumn). Slots of entities without the component are zero or stale.
+template <typename T>
+struct FieldColumn {
+    T* data;
+    size_t count;
+};
+
+/*
+ * An Archetype stores all entities that have exactly the same set of (allocated) components.
+ * The entities are stored densely in fixed-size chunks and each chunk has one column
+ * per component, so iterating over an archetype is just walking linearly through memory.
+ * Removing an entity moves the last entity into the free row, so rows are not stable!
+ */
+class Archetype {
+public:
+    static constexpr size_t chunkSize = 16 * 1024; // bytes
+
+    Archetype(const ComponentMask& mask, const std::vector<Component>& components);
+
+    const ComponentMask& getMask() const;
+
+    // The number of entities in this archetype
+    size_t getSize() const;
+
+    // Returns the row of the new entity. The components are zero-initialized.
+    size_t add(EntityId entityId);
+
+    // Returns the entity that was moved into the now free row (if there was one).
+    // This does not call Struct::free!
+    std::optional<EntityId> remove(size_t row);
+
+    bool hasColumn(ComponentId compId) const;
+    void* get(size_t row, ComponentId compId);
+    EntityId getEntity(size_t row) const;
+
+    size_t getChunkCapacity() const;
+    size_t getChunkCount() const;
+    // The number of rows in a chunk
+    size_t getChunkSize(size_t chunk) const;
+    const EntityId* getChunkEntities(size_t chunk) const;
+    void* getChunkColumn(size_t chunk, ComponentId compId);
+    void* get(size_t chunk, size_t index, ComponentId compId);
+
+    // Change tracking, see ComponentPool::setChanged
+    void setChanged(size_t row, ComponentId compId, uint32_t tick);
+    uint32_t getChangeTick(size_t row, ComponentId compId) const;
+    // The last change of the component in any row of the chunk
+    uint32_t getChunkChangeTick(size_t chunk, ComponentId compId) const;
+    const uint32_t* getChunkChangeTicks(size_t chunk, ComponentId compId) const;
+
+private:
+    struct Column {
+        ComponentId componentId;
+        size_t size;
+        size_t offset; // in bytes from the start of the chunk
+        size_t tickOffset; // the change ticks (uint32_t) of the column
+    };
+
+    // With more than 255 components a column index doesn't fit into a byte anymore
+    using ColumnIndex = std::conditional_t<(maxComponents < 255), uint8_t, uint16_t>;
+    static constexpr auto noColumn = std::numeric_limits<ColumnIndex>::max();
+
+    uint8_t* getChunk(size_t chunk);
+
+    ComponentMask mask_;
+    std::vector<Column> columns_;
+    std::array<ColumnIndex, maxComponents> columnIndex_;
+    size_t chunkCapacity_;
+    size_t chunkBytes_;
+    std::vector<std::unique_ptr<uint8_t[]>> chunks_;
+    // One tick per column for every chunk
+    std::vector<std::vector<std::atomic<uint32_t>>> chunkTicks_;
+    size_t size_ = 0;
+};
+
+class World;
+
+/*
+ * A Prefab holds a set of pre-initialized components, which can be instantiated into any
+ * number of entities. Instantiating copies the components with Struct::copy, so only
+ * strings and vectors have to allocate. Prefabs can be loaded from a file with loadPrefabs.
+ */
+class Prefab {
+public:
+    Prefab(World& world);
+    ~Prefab();
+
+    Prefab(Prefab&& other);
+    Prefab& operator=(Prefab&& other);
+    Prefab(const Prefab&) = delete;
+    Prefab& operator=(const Prefab&) = delete;
+
+    const ComponentMask& getMask() const;
+    bool hasComponent(ComponentId compId) const;
+
+    // The component is initialized, like with World::addComponent
+    template <typename T = void>
+    T* addComponent(ComponentId compId)
+    {
+        return reinterpret_cast<T*>(addComponentBuffer(compId));
+    }
+
+    template <typename T = void>
+    T* getComponent(ComponentId compId)
+    {
+        return reinterpret_cast<T*>(getComponentBuffer(compId));
+    }
+
+    void* addComponentBuffer(ComponentId compId);
+    void* getComponentBuffer(ComponentId compId);
+
+    // Returns the first entity, the others have the following ids (see World::newEntities)
+    EntityId instantiate(size_t count = 1) const;
+
+private:
+    void clear();
+
+    World* world_;
+    ComponentMask mask_;
+    std::vector<void*> components_; // indexed by component id
+};
+
+// Translates the ids from before World::compact to the ids after it
+class EntityRemap {
+public:
+    // Returns maxId<EntityId>() if id did not refer to an existing entity
+    EntityId get(EntityId oldId) const;
+    // For things that only store the index (like ComponentPool)
+    EntityId getByIndex(size_t oldIndex) const;
+
+private:
+    friend class World;
+
+    // Both indexed by the old index. The old ids are needed to check the generation.
+    std::vector<EntityId> oldIds_;
+    std::vector<EntityId> newIds_;
+};
+
 class World {
 public:
     struct System {
         std::string name;
         std::function<void(float)> function;
+        // Systems that don't declare which components they access might access anything,
+        // so they never run in parallel with other systems and always run on the thread
+        // that invokes them.
+        std::optional<ComponentAccess> access;
         double lastDuration = 0.0;
         bool enabled = true;
 
@@ -112,19 +343,348 @@ public:
         }
     };
 
-    World() = default;
+    struct TimelineEntry {
+        size_t system; // index into getSystems()
+        size_t thread; // 0 is the thread that called invokeSystems, workers start at 1
+        double start;
+        double end;
+    };
+
+    /*
+     * Pools: Every component has it's own ComponentPool, indexed by entity id.
+     * Archetypes: Entities with the same components are stored together (see Archetype).
+     * Adding and removing components is more expensive, because the entity has to be moved
+     * to another archetype, but iterating over many entities is a lot faster.
+     */
+    enum class Storage { Pools, Archetypes };
+
+    World();
     ~World();
 
+    // This can only be called as long as there are no entities.
+    void setStorage(Storage storage);
+    Storage getStorage() const;
+
+    // Also false for ids of destroyed entities, even if the index was reused
     bool entityExists(EntityId id) const;
 
+    // Allocates memory for count entities up front (see ComponentPool::reserve), so loading a
+    // big level doesn't reallocate in the middle of the game.
+    void reserveEntities(size_t count);
+
     EntityId newEntity();
 
+    /*
+     * Creates count entities with contiguous ids (the first one is returned) that already
+     * have all components in mask. This is a lot faster than creating them one by one,
+     * because the components are allocated in bulk.
+     */
+    EntityId newEntities(size_t count, const ComponentMask& mask = ComponentMask());
+
+    // Like above, but the components are copied from prototypes (indexed by component id)
+    // with Struct::copy instead of being initialized, if the prototype is not nullptr.
+    EntityId newEntities(
+        size_t count, const ComponentMask& mask, const void* const* prototypes);
+
     void destroyEntity(EntityId id);
 
-    // Implement foreachEntity in the future that returns a custom iterator.
-    std::vector<EntityId> getEntities(const ComponentMask& mask = ComponentMask()) const;
+    // Same as destroyEntity for every id. Removing them one pool at a time was slower
+    // (bench/destroy.cpp), because the pool removals dominate either way.
+    void destroyEntities(const EntityId* ids, size_t count);
+    void destroyEntities(const std::vector<EntityId>& ids);
+
+    /*
+     * Destroys every entity (pending commands are played back first). With freeFields = false
+     * the strings and vectors in the components are not freed, which only makes sense if they
+     * were allocated from an arena that is dropped right after (see endFieldArena).
+     */
+    void destroyAllEntities(bool freeFields = true);
+
+    /*
+     * For levels, beginFieldArena installs a separate SlabAllocator as the field allocator (see
+     * getFieldAllocator), and endFieldArena destroys all entities and frees the whole arena at
+     * once instead of freeing every string and vector. Entities that already existed in
+     * beginFieldArena are destroyed too, but their fields are freed normally.
+     * The field allocator is global, so everything that allocates in between uses the arena.
+     * Prefabs, SystemData and other Worlds would point into the dropped arena, so only load
+     * and modify them outside of it. Arenas of different Worlds have to be ended in reverse.
+     */
+    void beginFieldArena();
+    void endFieldArena();
+
+    /*
+     * Renumbers all entities densely (starting at 0) and rebuilds the pools (or archetypes),
+     * so there are no half-empty pages after a lot of entities were created and destroyed.
+     * The entities are ordered by sortKey (e.g. the Morton code of their position, see
+     * mortonCode) or, if it is empty, grouped by their components. Ids that are held
+     * anywhere else (components, Lua, SystemData) have to be translated with the returned
+     * remap. Pending commands are played back first. No observers are called.
+     * This is slow, so only do it while loading.
+     */
+    EntityRemap compact(const std::function<uint64_t(EntityId)>& sortKey = nullptr);
+
+    /*
+     * Lazily iterates over all entities that have all components in a mask enabled.
+     * With Storage::Pools the pool with the fewest components in the mask drives the
+     * iteration, so if the mask includes a rare component only those entities are visited.
+     * Creating and destroying entities or adding and removing components while iterating is
+     * fine with paged pools, but with sparse pools or Storage::Archetypes the affected
+     * entities might move around, so some entities might be skipped or visited twice.
+     */
+    class EntityIterator {
+    public:
+        // Iteration ends when the iterator runs out of entities, so the end is not a position
+        struct Sentinel {
+        };
+
+        EntityIterator(World* world, const ComponentMask& mask,
+            const std::optional<ChangeFilter>& changed = std::nullopt);
+
+        EntityId operator*() const
+        {
+            return id_;
+        }
+
+        EntityIterator& operator++();
+
+        bool operator==(Sentinel) const;
+        bool operator!=(Sentinel) const;
+
+        // Only valid for components in the mask. nullptr for tags, like getComponentBuffer.
+        void* getComponent(ComponentId compId) const;
+
+        /*
+         * Splits the whole iteration (regardless of the current position) into iterators
+         * that each visit a disjoint part of it (whole pool pages or archetype chunks),
+         * so they can be processed in parallel. Empty parts are left out.
+         */
+        std::vector<EntityIterator> split() const;
+
+    private:
+        // Finds the next matching entity, starting at (and including) the current position
+        void findNext();
+
+        World* world_;
+        ComponentMask mask_;
+        std::optional<ChangeFilter> changed_;
+        EntityId id_;
+        bool end_ = false;
+        // Storage::Pools: If there is no driver, all entities are visited.
+        // With a ChangeFilter the pool of the changed component is always the driver.
+        const ComponentPool* driver_ = nullptr;
+        size_t cursor_ = 0;
+        // Storage::Archetypes
+        size_t archetype_ = 0;
+        size_t chunk_ = 0;
+        size_t index_ = 0; // entity index without a driver, index in the chunk with archetypes
+        // For split iterators: The end of the cursor range with a driver, the end of the
+        // entity index range without one and with archetypes only a single chunk is visited.
+        size_t limit_ = std::numeric_limits<size_t>::max();
+        bool singleChunk_ = false;
+    };
+
+    /*
+     * Iterates over the members of a query (see registerQuery) backwards, so that
+     * removing the current entity from the query (by removing or disabling a component
+     * or destroying it) is fine. Entities that join the query while iterating are skipped.
+     */
+    class QueryIterator {
+    public:
+        struct Sentinel {
+        };
+
+        QueryIterator(World* world, QueryId query);
+
+        EntityId operator*() const
+        {
+            return world_->queries_[query_].members[index_ - 1];
+        }
+
+        QueryIterator& operator++();
+
+        bool operator==(Sentinel) const;
+        bool operator!=(Sentinel) const;
+
+        void* getComponent(ComponentId compId) const;
+
+        // See EntityIterator::split
+        std::vector<QueryIterator> split() const;
+
+    private:
+        World* world_;
+        size_t query_;
+        size_t index_; // one past the current member
+        size_t begin_ = 0; // iteration ends when index_ reaches this
+    };
+
+    // Like Iterator, but yields std::tuple<EntityId, Components*...>
+    template <typename Iterator, typename... Components>
+    class ViewIterator {
+    public:
+        using Sentinel = typename Iterator::Sentinel;
+        using Value = std::tuple<EntityId, Components*...>;
+
+        ViewIterator(Iterator it, const std::array<ComponentId, sizeof...(Components)>& ids)
+            : it_(it)
+            , ids_(ids)
+        {
+        }
+
+        Value operator*() const
+        {
+            return get(std::index_sequence_for<Components...>());
+        }
+
+        ViewIterator& operator++()
+        {
+            ++it_;
+            return *this;
+        }
+
+        bool operator==(Sentinel sentinel) const
+        {
+            return it_ == sentinel;
+        }
+
+        bool operator!=(Sentinel sentinel) const
+        {
+            return it_ != sentinel;
+        }
+
+        std::vector<ViewIterator> split() const
+        {
+            std::vector<ViewIterator> parts;
+            for (const auto& it : it_.split())
+                parts.emplace_back(it, ids_);
+            return parts;
+        }
+
+    private:
+        template <size_t... Indices>
+        Value get(std::index_sequence<Indices...>) const
+        {
+            return Value(*it_, reinterpret_cast<Components*>(it_.getComponent(ids_[Indices]))...);
+        }
+
+        Iterator it_;
+        std::array<ComponentId, sizeof...(Components)> ids_;
+    };
+
+    template <typename Iterator>
+    class Range {
+    public:
+        Range(const Iterator& begin)
+            : begin_(begin)
+        {
+        }
+
+        Iterator begin() const
+        {
+            return begin_;
+        }
+
+        typename Iterator::Sentinel end() const
+        {
+            return typename Iterator::Sentinel {};
+        }
+
+    private:
+        Iterator begin_;
+    };
+
+    Range<EntityIterator> foreachEntity(const ComponentMask& mask = ComponentMask());
+
+    // for (auto [entity, trafo] : world.view<Transform>(transformId))
+    template <typename... Components, typename... Ids>
+    Range<ViewIterator<EntityIterator, Components...>> view(Ids... compIds)
+    {
+        static_assert(sizeof...(Components) == sizeof...(Ids), "Pass one id per component");
+        static_assert((std::is_same_v<Ids, ComponentId> && ...), "Ids must be ComponentIds");
+        ComponentMask mask;
+        (mask.add(compIds), ...);
+        return ViewIterator<EntityIterator, Components...>(
+            EntityIterator(this, mask), { compIds... });
+    }
+
+    // Only the entities for which the filter matches too. The mask includes the component.
+    Range<EntityIterator> foreachEntity(const ComponentMask& mask, const ChangeFilter& changed);
+
+    template <typename... Components, typename... Ids>
+    Range<ViewIterator<EntityIterator, Components...>> view(
+        const ChangeFilter& changed, Ids... compIds)
+    {
+        static_assert(sizeof...(Components) == sizeof...(Ids), "Pass one id per component");
+        static_assert((std::is_same_v<Ids, ComponentId> && ...), "Ids must be ComponentIds");
+        ComponentMask mask;
+        (mask.add(compIds), ...);
+        return ViewIterator<EntityIterator, Components...>(
+            EntityIterator(this, mask, changed), { compIds... });
+    }
+
+    /*
+     * A query keeps a list of all entities that have all components in include enabled
+     * and none of the components in exclude. It is updated every time the components of an
+     * entity change, so iterating over it is O(matches) instead of O(entities).
+     */
+    QueryId registerQuery(
+        const ComponentMask& include, const ComponentMask& exclude = ComponentMask());
+    void unregisterQuery(QueryId query);
+
+    Range<QueryIterator> foreachEntity(QueryId query);
+
+    // The compIds must be included in the query
+    template <typename... Components, typename... Ids>
+    Range<ViewIterator<QueryIterator, Components...>> view(QueryId query, Ids... compIds)
+    {
+        static_assert(sizeof...(Components) == sizeof...(Ids), "Pass one id per component");
+        static_assert((std::is_same_v<Ids, ComponentId> && ...), "Ids must be ComponentIds");
+        assert((queries_[static_cast<size_t>(query)].include.includes(compIds) && ...));
+        return ViewIterator<QueryIterator, Components...>(
+            QueryIterator(this, query), { compIds... });
+    }
+
+    size_t getQuerySize(QueryId query) const;
+
+    /*
+     * Calls func for every element of range (which you get from foreachEntity or view) on
+     * the thread pool (see setWorkerCount) and returns when all of them are done.
+     * The range is split into parts (see EntityIterator::split), which are distributed
+     * over the threads with work stealing. For ranges of EntityIterator or QueryIterator,
+     * func takes an EntityId and for views it takes the same arguments as the tuple.
+     * func has to be thread-safe and nothing may create or destroy entities or add or
+     * remove components until this returns.
+     * myl::parallelForEach(myl::view<c::Transform>(cTrafo),
+     *     [dt](myl::EntityId, c::Transform* trafo) { trafo->angle += dt; });
+     * See bench/parallelforeach.cpp for how this scales.
+     */
+    template <typename Iterator, typename Func>
+    void parallelForEach(const Range<Iterator>& range, Func&& func)
+    {
+        const auto parts = range.begin().split();
+        getThreadPool().parallelFor(parts.size(), [&parts, &func](size_t index, size_t) {
+            for (auto it = parts[index]; it != typename Iterator::Sentinel {}; ++it) {
+                if constexpr (std::is_same_v<std::decay_t<decltype(*it)>, EntityId>)
+                    func(*it);
+                else
+                    std::apply(func, *it);
+            }
+        });
+    }
+
+    template <typename Func>
+    void parallelForEach(QueryId query, Func&& func)
+    {
+        parallelForEach(foreachEntity(query), std::forward<Func>(func));
+    }
+
+    // This allocates, so prefer foreachEntity or view.
+    std::vector<EntityId> getEntities(const ComponentMask& mask = ComponentMask());
 
-    void registerComponent(const std::string& name, Struct&& strct);
+    // The alignment in options is raised to the alignment of the struct and the column sizes
+    // are filled in for SoA pools.
+    void registerComponent(const std::string& name, Struct&& strct,
+        ComponentPool::Type poolType = ComponentPool::Type::Paged,
+        ComponentPool::Options options = ComponentPool::Options());
 
     const Component& getComponent(ComponentId compId) const;
 
@@ -136,11 +696,7 @@ public:
     T* addComponent(EntityId id, ComponentId compId)
     {
         assert(!hasComponent(id, compId));
-        const auto compIndex = static_cast<size_t>(compId);
-        entities_[static_cast<size_t>(id)].components += compId;
-        auto ptr = componentPools_[compIndex].add(id);
-        components_[compIndex].getStruct().init(ptr);
-        return reinterpret_cast<T*>(ptr);
+        return reinterpret_cast<T*>(addComponentBuffer(id, compId));
     }
 
     template <typename T = void>
@@ -150,8 +706,42 @@ public:
         return reinterpret_cast<T*>(getComponentBuffer(id, compId));
     }
 
+    /*
+     * Change tracking: The world has a tick, which invokeSystems advances when it starts.
+     * If you call invokeSystem instead, call advanceTick once per frame yourself.
+     * Adding a component, getMutableComponent and markChanged remember the current tick for
+     * the component, so you can visit only the entities that changed since some tick
+     * (see ChangeFilter). Writes through pointers from getComponent or a view are not
+     * tracked, so call markChanged for those.
+     * A system that wants to see every change since it ran last can remember getTick()
+     * and filter by it next time. That includes changes made after it ran in the same tick,
+     * but also the ones before it (and its own).
+     */
+    uint32_t getTick() const;
+    void advanceTick();
+
+    // This is thread-safe for different entities
+    void markChanged(EntityId id, ComponentId compId);
+    uint32_t getChangeTick(EntityId id, ComponentId compId);
+
+    template <typename T = void>
+    T* getMutableComponent(EntityId id, ComponentId compId)
+    {
+        markChanged(id, compId);
+        return getComponent<T>(id, compId);
+    }
+
     void removeComponent(EntityId id, ComponentId compId);
 
+    // Prefab names must be unique
+    void registerPrefab(const std::string& name, Prefab&& prefab);
+    bool hasPrefab(const std::string& name) const;
+    Prefab& getPrefab(const std::string& name);
+
+    // Removes the component from all entities. With Storage::Pools the pool drops all of
+    // it's pages at once, with Storage::Archetypes every entity has to be moved though.
+    void clearComponent(ComponentId compId);
+
     /*
      * Enabling/Disabling: There are two places where a (in a way) an entity-component
      * association is saved. Once here in the world (with a ComponentMask in Entity)
@@ -170,29 +760,161 @@ public:
 
     // This is mostly for internal use? I need it in the Entity Inspector
     bool isComponentAllocated(EntityId id, ComponentId compId);
+    void* addComponentBuffer(EntityId id, ComponentId compId);
     void* getComponentBuffer(EntityId id, ComponentId compId);
 
+    /*
+     * Components registered with ComponentPool::Type::Soa store every field in it's own
+     * column (only with Storage::Pools, archetypes ignore it). There is no struct to point
+     * to, so getComponent/addComponent return nullptr for them and they can't be used in
+     * views. Access the fields with these instead, which work for every component.
+     * SoA components have to be trivial (no strings, vectors, etc.) and not contain packed
+     * bools. field is the index in Struct::getFields().
+     */
+    void* getFieldBuffer(EntityId id, ComponentId compId, size_t field);
+
+    template <typename T>
+    T* getField(EntityId id, ComponentId compId, size_t field)
+    {
+        assert(sizeof(T) == getComponent(compId).getStruct().getFields()[field].size);
+        return reinterpret_cast<T*>(getFieldBuffer(id, compId, field));
+    }
+
+    // For SoA components this is the rest of the page, otherwise it's just one value
+    FieldColumn<void> getFieldColumnBuffer(EntityId id, ComponentId compId, size_t field);
+
+    template <typename T>
+    FieldColumn<T> getFieldColumn(EntityId id, ComponentId compId, size_t field)
+    {
+        assert(sizeof(T) == getComponent(compId).getStruct().getFields()[field].size);
+        const auto column = getFieldColumnBuffer(id, compId, field);
+        return FieldColumn<T> { reinterpret_cast<T*>(column.data), column.count };
+    }
+
+    std::vector<Archetype>& getArchetypes();
+
     ComponentId getComponentId(const std::string& name) const;
+    std::optional<ComponentId> findComponentId(const std::string& name) const;
+
+    /*
+     * A CommandBuffer records structural changes (creating and destroying entities, adding
+     * and removing components) so they can be applied later, when nothing iterates over the
+     * entities or runs on other threads (see playbackCommands).
+     * There is one buffer per thread of the thread pool (see getCommandBuffer), so recording
+     * does not need any locks. newEntity returns an id right away, which can be used in
+     * other commands, but the entity only exists after playback. The buffers of the workers
+     * reserve as many recycled ids during playback as they used since the last one, the one
+     * of the main thread takes them from the free list directly, and fresh ids come from an
+     * atomic counter.
+     * Commands for entities that don't exist anymore during playback are dropped and adding
+     * a component that is already there replaces it.
+     */
+    class CommandBuffer {
+    public:
+        CommandBuffer(World* world);
+        ~CommandBuffer();
+
+        CommandBuffer(const CommandBuffer&) = delete;
+        CommandBuffer& operator=(const CommandBuffer&) = delete;
+
+        EntityId newEntity();
+        void destroyEntity(EntityId id);
+
+        // The returned component is initialized already and moved into the entity during
+        // playback. It stays valid until then.
+        template <typename T = void>
+        T* addComponent(EntityId id, ComponentId compId)
+        {
+            return reinterpret_cast<T*>(addComponentBuffer(id, compId));
+        }
+
+        void* addComponentBuffer(EntityId id, ComponentId compId);
+        void removeComponent(EntityId id, ComponentId compId);
+        void setComponentEnabled(EntityId id, ComponentId compId, bool enabled = true);
+
+        bool isEmpty() const;
+
+    private:
+        friend class World;
+
+        enum class CommandType {
+            NewEntity,
+            DestroyEntity,
+            AddComponent,
+            RemoveComponent,
+            EnableComponent,
+            DisableComponent,
+        };
+
+        struct Command {
+            CommandType type;
+            EntityId entity;
+            ComponentId component;
+            void* data; // only for AddComponent
+        };
+
+        // Staged components live in blocks, which are reused after playback
+        struct Block {
+            std::unique_ptr<uint8_t[]> data;
+            size_t size;
+        };
+
+        static constexpr size_t minBlockSize = 16 * 1024;
+
+        void* allocate(size_t size, size_t alignment);
+        void playback();
+        void reserveIds();
+
+        World* world_;
+        std::vector<Command> commands_;
+        std::vector<Block> blocks_;
+        size_t block_ = 0;
+        size_t blockOffset_ = 0;
+        std::vector<EntityId> reservedIds_;
+        size_t usedIds_ = 0; // since the last playback
+    };
+
+    // The command buffer of the calling thread
+    CommandBuffer& getCommandBuffer();
+
+    // This must not be called while systems are running in parallel (invokeSystems calls it)
+    void playbackCommands();
 
     template <typename Func>
     void registerSystem(const std::string& name, Func&& func)
     {
-        // This is kind of a hack to sort the internal systems vector of World,
-        // but for some things I want it to be sorted.
-        auto it = systems_.begin();
-        while (it != systems_.end() && it->name < name)
-            it++;
-        systems_.emplace(it, name, std::forward<Func>(func));
+        addSystem(System(name, std::forward<Func>(func)));
+    }
 
-        systemNames_.clear();
-        for (size_t i = 0; i < systems_.size(); ++i)
-            systemNames_.emplace(systems_[i].name, i);
+    template <typename Func>
+    void registerSystem(const std::string& name, const ComponentAccess& access, Func&& func)
+    {
+        System system(name, std::forward<Func>(func));
+        system.access = access;
+        addSystem(std::move(system));
     }
 
     void unregisterSystem(const std::string& name);
 
     void invokeSystem(const std::string& name, float dt);
 
+    /*
+     * Invokes all the systems in order, except that systems which declared the components
+     * they access may run in parallel on worker threads, as long as they don't conflict with
+     * any system before them that has not finished yet.
+     * Systems running in parallel must not create or destroy entities or add or remove
+     * components directly, but they can use getCommandBuffer. Commands are played back
+     * before every system that runs on the calling thread and at the end.
+     */
+    void invokeSystems(const std::vector<std::string>& names, float dt);
+
+    // 0 means one less than the number of hardware threads
+    void setWorkerCount(size_t count);
+
+    // Which system ran on which thread when during the last invokeSystems.
+    // Empty after unregisterSystem, because the system indices changed.
+    const std::vector<TimelineEntry>& getTimeline() const;
+
     std::vector<System>& getSystems();
 
     void setSystemEnabled(const std::string& name, bool enabled = true);
@@ -200,31 +922,204 @@ public:
 
     boost::signals2::signal<void(const Component&)> componentRegistered;
 
+    /*
+     * Observers are called when a component of an entity is added, removed, enabled,
+     * disabled or when the entity is destroyed while it has the component (enabled or not).
+     * Remove and Destroy are sent before the component is freed, the others after the change.
+     * These are not signals2 signals, because they are sent a lot, so an observer is just
+     * a function pointer and some user data. Observers must not create or destroy entities
+     * or add or remove components.
+     */
+    enum class ComponentEvent { Add, Remove, Enable, Disable, Destroy };
+    using Observer = void (*)(void* userData, ComponentEvent event, EntityId id);
+
+    void addObserver(ComponentId compId, Observer observer, void* userData);
+    void removeObserver(ComponentId compId, Observer observer, void* userData);
+
 private:
     struct Entity {
         bool exists;
+        // These are the enabled components
         ComponentMask components;
+        // The allocated (enabled or disabled) components, only used with Storage::Pools
+        ComponentMask allocated = ComponentMask();
+        // Incremented when the entity is destroyed (see EntityId)
+        uint32_t generation = 0;
+        // Only used with Storage::Archetypes
+        size_t archetype = 0;
+        size_t row = 0;
     };
 
+    struct Query {
+        static constexpr auto noIndex = std::numeric_limits<uint32_t>::max();
+
+        bool active;
+        ComponentMask include;
+        ComponentMask exclude;
+        std::vector<EntityId> members;
+        // Index into members for every entity (or noIndex)
+        std::vector<uint32_t> indices;
+
+        bool matches(const Entity& entity) const;
+        bool isMember(EntityId id) const;
+        void add(EntityId id);
+        void remove(EntityId id);
+    };
+
+    struct ObserverEntry {
+        Observer observer;
+        void* userData;
+    };
+
+    /*
+     * The free entity indices as a bitset with another bitset on top, that marks the non-empty
+     * words. That way the smallest free index (reusing those keeps the pools dense) can be
+     * found with two countTrailingZeros instead of keeping a heap.
+     */
+    class IndexFreeList {
+    public:
+        bool empty() const;
+        void push(size_t index);
+        // Removes and returns the smallest free index
+        size_t pop();
+        // Removes the first run of count consecutive free indices and returns its first index
+        std::optional<size_t> popRange(size_t count);
+
+    private:
+        std::vector<uint64_t> words_;
+        std::vector<uint64_t> nonEmptyWords_;
+        // All of nonEmptyWords_ before this are 0
+        size_t firstNonEmpty_ = 0;
+        size_t size_ = 0;
+    };
+
+    void notify(ComponentId compId, ComponentEvent event, EntityId id);
+
+    // The id of the (existing or free) entity with that index with the current generation
+    EntityId getEntityId(size_t index) const;
+    // Gives the free indices [first, first + count) the same generation (see newEntities)
+    uint32_t unifyGenerations(size_t first, size_t count);
+
+    // Makes a free or reserved id exist
+    void createEntity(EntityId id);
+    // Gives the ids reserved by the command buffers back to the free list
+    void releaseReservedIds();
+    // Everything destroyEntity does, except giving back the id
+    void freeEntity(EntityId id);
+    // Like addComponentBuffer, but does not initialize the component or update the queries
+    void* allocateComponent(EntityId id, ComponentId compId);
+    // Copies the bytes of a whole component into an allocated component. ptr is what
+    // allocateComponent returned, which is nullptr for SoA components.
+    void setComponentData(EntityId id, ComponentId compId, void* ptr, const void* src);
+
+    size_t getArchetype(const ComponentMask& mask);
+    void moveEntity(EntityId id, const ComponentMask& mask);
+
+    void addSystem(System&& system);
+    void runSystem(System& system, float dt);
+    ThreadPool& getThreadPool();
+
+    // Has to be called every time the components of an entity change
+    void updateQueries(EntityId id);
+
+    std::unique_ptr<SlabAllocator> fieldArena_;
+    Allocator* fieldArenaPrevious_ = nullptr;
+    // The entities that existed in beginFieldArena, their fields are not in the arena
+    std::vector<EntityId> preArenaEntities_;
+
+    Storage storage_ = Storage::Pools;
+
     std::vector<Component> components_;
     boost::container::flat_map<std::string, ComponentId> componentNames_;
-    std::vector<ComponentPool> componentPools_;
+    std::vector<std::unique_ptr<ComponentPool>> componentPools_;
+    // Components with strings, vectors, etc. (see Struct::isTrivial), so ~World only has to
+    // visit their pools. Struct::init and Struct::free do nothing for the others anyway.
+    ComponentMask nonTrivial_;
+    std::vector<std::vector<ObserverEntry>> observers_; // per component
+    // Declared after components_, because they need the component structs to free their data
+    boost::container::flat_map<std::string, Prefab> prefabs_;
 
     std::vector<Entity> entities_;
-    std::priority_queue<EntityId, std::vector<EntityId>, IdGreater<EntityId>> entityIdFreeList_;
+    IndexFreeList freeIndices_;
+    // Indices >= this have never been used. Command buffers take ids from here concurrently.
+    std::atomic<size_t> nextEntityId_ { 0 };
+
+    // The first archetype is always the one without any components
+    std::vector<Archetype> archetypes_;
+    std::unordered_map<ComponentMask, size_t, ComponentMask::Hash> archetypeIndices_;
+
+    std::vector<Query> queries_;
+
+    uint32_t tick_ = 1;
 
     std::vector<System> systems_;
     boost::container::flat_map<std::string, size_t> systemNames_;
+    std::vector<TimelineEntry> timeline_;
+    size_t workerCount_ = 0;
+    // One per thread of threadPool_ (or just one without it). Destroyed before the pool.
+    std::vector<std::unique_ptr<CommandBuffer>> commandBuffers_;
+    std::unique_ptr<ThreadPool> threadPool_;
 };
 
 World& getDefaultWorld();
 
 bool entityExists(EntityId id);
+void reserveEntities(size_t count);
 EntityId newEntity();
+EntityId newEntities(size_t count, const ComponentMask& mask = ComponentMask());
 void destroyEntity(EntityId id);
+void destroyEntities(const EntityId* ids, size_t count);
+void destroyEntities(const std::vector<EntityId>& ids);
+void destroyAllEntities(bool freeFields = true);
+void beginFieldArena();
+void endFieldArena();
+EntityRemap compact(const std::function<uint64_t(EntityId)>& sortKey = nullptr);
+World::Range<World::EntityIterator> foreachEntity(const ComponentMask& mask = ComponentMask());
+
+template <typename... Components, typename... Ids>
+World::Range<World::ViewIterator<World::EntityIterator, Components...>> view(Ids... compIds)
+{
+    return getDefaultWorld().view<Components...>(compIds...);
+}
+
+World::Range<World::EntityIterator> foreachEntity(
+    const ComponentMask& mask, const ChangeFilter& changed);
+
+template <typename... Components, typename... Ids>
+World::Range<World::ViewIterator<World::EntityIterator, Components...>> view(
+    const ChangeFilter& changed, Ids... compIds)
+{
+    return getDefaultWorld().view<Components...>(changed, compIds...);
+}
+
+QueryId registerQuery(const ComponentMask& include, const ComponentMask& exclude = ComponentMask());
+void unregisterQuery(QueryId query);
+World::Range<World::QueryIterator> foreachEntity(QueryId query);
+
+template <typename... Components, typename... Ids>
+World::Range<World::ViewIterator<World::QueryIterator, Components...>> view(
+    QueryId query, Ids... compIds)
+{
+    return getDefaultWorld().view<Components...>(query, compIds...);
+}
+
+template <typename Iterator, typename Func>
+void parallelForEach(const World::Range<Iterator>& range, Func&& func)
+{
+    getDefaultWorld().parallelForEach(range, std::forward<Func>(func));
+}
+
+template <typename Func>
+void parallelForEach(QueryId query, Func&& func)
+{
+    getDefaultWorld().parallelForEach(query, std::forward<Func>(func));
+}
+
 std::vector<EntityId> getEntities(const ComponentMask& mask = ComponentMask());
 
-void registerComponent(const std::string& name, Struct&& strct);
+void registerComponent(const std::string& name, Struct&& strct,
+    ComponentPool::Type poolType = ComponentPool::Type::Paged,
+    ComponentPool::Options options = ComponentPool::Options());
 const Component& getComponent(ComponentId compId);
 const std::vector<Component>& getComponents();
 
@@ -242,13 +1137,43 @@ T* getComponent(EntityId id, ComponentId compId)
     return getDefaultWorld().getComponent<T>(id, compId);
 }
 
+uint32_t getTick();
+void advanceTick();
+void markChanged(EntityId id, ComponentId compId);
+uint32_t getChangeTick(EntityId id, ComponentId compId);
+
+template <typename T = void>
+T* getMutableComponent(EntityId id, ComponentId compId)
+{
+    return getDefaultWorld().getMutableComponent<T>(id, compId);
+}
+
 void removeComponent(EntityId id, ComponentId compId);
+void clearComponent(ComponentId compId);
+
+void registerPrefab(const std::string& name, Prefab&& prefab);
+bool hasPrefab(const std::string& name);
+Prefab& getPrefab(const std::string& name);
 
 void setComponentEnabled(EntityId id, ComponentId compId, bool enabled = true);
 void setComponentDisabled(EntityId id, ComponentId compId);
 
 bool isComponentAllocated(EntityId id, ComponentId compId);
 void* getComponentBuffer(EntityId id, ComponentId compId);
+void* getFieldBuffer(EntityId id, ComponentId compId, size_t field);
+FieldColumn<void> getFieldColumnBuffer(EntityId id, ComponentId compId, size_t field);
+
+template <typename T>
+T* getField(EntityId id, ComponentId compId, size_t field)
+{
+    return getDefaultWorld().getField<T>(id, compId, field);
+}
+
+template <typename T>
+FieldColumn<T> getFieldColumn(EntityId id, ComponentId compId, size_t field)
+{
+    return getDefaultWorld().getFieldColumn<T>(id, compId, field);
+}
 
 ComponentId getComponentId(const std::string& name);
 
@@ -258,12 +1183,24 @@ void registerSystem(const std::string& name, Func&& func)
     getDefaultWorld().registerSystem(name, std::forward<Func>(func));
 }
 
+template <typename Func>
+void registerSystem(const std::string& name, const ComponentAccess& access, Func&& func)
+{
+    getDefaultWorld().registerSystem(name, access, std::forward<Func>(func));
+}
+
 void unregisterSystem(const std::string& name);
 
 void invokeSystem(const std::string& name, float dt);
+void invokeSystems(const std::vector<std::string>& names, float dt);
+
+const std::vector<World::TimelineEntry>& getTimeline();
 
 std::vector<World::System>& getSystems();
 
+World::CommandBuffer& getCommandBuffer();
+void playbackCommands();
+
 void setSystemEnabled(const std::string& name, bool enabled = true);
 void setSystemDisabled(const std::string& name);
 
@@ -303,16 +1240,21 @@ public:
         , boundComponent_(componentId)
         , data_(sizeof(T))
     {
+        world_.addObserver(boundComponent_, &SystemData::observe, this);
     }
 
     ~SystemData()
     {
-        for (auto entityId : world_.getEntities()) {
-            if (has(entityId))
-                remove(entityId);
-        }
+        world_.removeObserver(boundComponent_, &SystemData::observe, this);
+        size_t cursor = 0;
+        EntityId entityId(0);
+        while (data_.getNext(cursor, entityId))
+            remove(entityId);
     }
 
+    SystemData(const SystemData&) = delete;
+    SystemData& operator=(const SystemData&) = delete;
+
     bool has(EntityId id) const
     {
         return data_.has(id);
@@ -344,18 +1286,53 @@ public:
         data_.remove(id);
     }
 
+    // Removes the data of all entities that had the bound component removed or disabled
+    // since the last call. Data of destroyed entities is removed right away.
     void remove()
     {
-        for (auto entityId : world_.getEntities()) {
-            if (has(entityId) && !world_.hasComponent(entityId, boundComponent_))
+        for (const auto entityId : stale_) {
+            // The entity might have been destroyed since and its index reused, so has is not
+            // enough (the data of destroyed entities is gone already).
+            if (world_.entityExists(entityId) && has(entityId)
+                && !world_.hasComponent(entityId, boundComponent_))
                 remove(entityId);
         }
+        stale_.clear();
+    }
+
+    // Moves the data to the new ids after World::compact
+    void remap(const EntityRemap& remap)
+    {
+        PagedComponentPool data(sizeof(T));
+        size_t cursor = 0;
+        EntityId entityId(0);
+        while (data_.getNext(cursor, entityId)) {
+            const auto newId = remap.getByIndex(getIndex(entityId));
+            assert(newId != maxId<EntityId>());
+            T* ptr = reinterpret_cast<T*>(data_.get(entityId));
+            new (data.add(newId)) T(std::move(*ptr));
+            ptr->~T();
+        }
+        data_ = std::move(data);
+        for (auto& entityId : stale_)
+            entityId = remap.get(entityId);
     }
 
 private:
+    static void observe(void* userData, World::ComponentEvent event, EntityId id)
+    {
+        auto self = reinterpret_cast<SystemData*>(userData);
+        if (event == World::ComponentEvent::Destroy && self->has(id))
+            self->remove(id);
+        else if (event == World::ComponentEvent::Remove
+            || event == World::ComponentEvent::Disable)
+            self->stale_.push_back(id);
+    }
+
     World& world_;
     ComponentId boundComponent_;
-    ComponentPool data_;
+    PagedComponentPool data_;
+    std::vector<EntityId> stale_;
 };
 
 }
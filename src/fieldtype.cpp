@@ -1,9 +1,12 @@
 #include "fieldtype.hpp"
 
 #include <cassert>
+#include <cstring>
 #include <sstream>
 
+#include "atom.hpp"
 #include "color.hpp"
+#include "structmap.hpp"
 #include "structstring.hpp"
 #include "structvector.hpp"
 
@@ -24,6 +27,16 @@ void FieldType::free(void* /*ptr*/) const
     // do nothing most of the time
 }
 
+void FieldType::copy(void* dst, const void* src) const
+{
+    std::memcpy(dst, src, getSize());
+}
+
+bool FieldType::isTrivial() const
+{
+    return true;
+}
+
 size_t FieldType::getSize() const
 {
     assert(false && "Unimplemented");
@@ -200,6 +213,16 @@ void StringFieldType::free(void* ptr) const
     reinterpret_cast<myl::String*>(ptr)->~String();
 }
 
+void StringFieldType::copy(void* dst, const void* src) const
+{
+    new (dst) myl::String(*reinterpret_cast<const myl::String*>(src));
+}
+
+bool StringFieldType::isTrivial() const
+{
+    return false;
+}
+
 std::string StringFieldType::asString() const
 {
     return "string";
@@ -215,6 +238,26 @@ size_t StringFieldType::getAlignment() const
     return std::alignment_of_v<myl::String>;
 }
 
+AtomFieldType::AtomFieldType()
+    : FieldType(FieldType::Atom)
+{
+}
+
+std::string AtomFieldType::asString() const
+{
+    return "atom";
+}
+
+size_t AtomFieldType::getSize() const
+{
+    return sizeof(myl::Atom);
+}
+
+size_t AtomFieldType::getAlignment() const
+{
+    return std::alignment_of_v<myl::Atom>;
+}
+
 EnumFieldType::EnumFieldType(const std::string& name)
     : FieldType(FieldType::Enum)
     , name(name)
@@ -255,6 +298,23 @@ void ArrayFieldType::free(void* ptr) const
         elementType->free(reinterpret_cast<uint8_t*>(ptr) + i * elementType->getSize());
 }
 
+void ArrayFieldType::copy(void* dst, const void* src) const
+{
+    if (elementType->isTrivial()) {
+        std::memcpy(dst, src, getSize());
+        return;
+    }
+    const auto elemSize = elementType->getSize();
+    for (size_t i = 0; i < size; ++i)
+        elementType->copy(reinterpret_cast<uint8_t*>(dst) + i * elemSize,
+            reinterpret_cast<const uint8_t*>(src) + i * elemSize);
+}
+
+bool ArrayFieldType::isTrivial() const
+{
+    return elementType->isTrivial();
+}
+
 std::string ArrayFieldType::asString() const
 {
     return "array<" + elementType->asString() + ", " + std::to_string(size) + ">";
@@ -296,6 +356,16 @@ void VectorFieldType::free(void* ptr) const
     reinterpret_cast<myl::Vector*>(ptr)->~Vector();
 }
 
+void VectorFieldType::copy(void* dst, const void* src) const
+{
+    new (dst) myl::Vector(*reinterpret_cast<const myl::Vector*>(src));
+}
+
+bool VectorFieldType::isTrivial() const
+{
+    return false;
+}
+
 std::string VectorFieldType::asString() const
 {
     return "vector<" + elementType->asString() + ">";
@@ -308,14 +378,56 @@ MapFieldType::MapFieldType(std::shared_ptr<FieldType> keyType, std::shared_ptr<F
 {
 }
 
-void MapFieldType::init(void* /*ptr*/) const
+bool MapFieldType::isValidKeyType(const FieldType& type)
+{
+    switch (type.fieldType) {
+    case FieldType::Builtin:
+        switch (dynamic_cast<const PrimitiveFieldType&>(type).type) {
+        case PrimitiveFieldType::Bool:
+        case PrimitiveFieldType::U8:
+        case PrimitiveFieldType::I8:
+        case PrimitiveFieldType::U16:
+        case PrimitiveFieldType::I16:
+        case PrimitiveFieldType::U32:
+        case PrimitiveFieldType::I32:
+        case PrimitiveFieldType::U64:
+        case PrimitiveFieldType::I64:
+            return true;
+        default:
+            return false;
+        }
+    case FieldType::String:
+    case FieldType::Atom:
+    case FieldType::Enum:
+        return true;
+    case FieldType::Array: {
+        // Arrays of strings would be compared by their pointers
+        const auto& elementType = *dynamic_cast<const ArrayFieldType&>(type).elementType;
+        return elementType.isTrivial() && isValidKeyType(elementType);
+    }
+    default:
+        return false;
+    }
+}
+
+void MapFieldType::init(void* ptr) const
+{
+    new (ptr) myl::Map(this);
+}
+
+void MapFieldType::free(void* ptr) const
 {
-    assert(false && "Unimplemented: map init");
+    reinterpret_cast<myl::Map*>(ptr)->~Map();
 }
 
-void MapFieldType::free(void* /*ptr*/) const
+void MapFieldType::copy(void* dst, const void* src) const
 {
-    assert(false && "Unimplemented: map free");
+    new (dst) myl::Map(*reinterpret_cast<const myl::Map*>(src));
+}
+
+bool MapFieldType::isTrivial() const
+{
+    return false;
 }
 
 std::string MapFieldType::asString() const
@@ -323,6 +435,16 @@ std::string MapFieldType::asString() const
     return "map<" + keyType->asString() + ", " + valueType->asString() + ">";
 }
 
+size_t MapFieldType::getSize() const
+{
+    return sizeof(myl::Map);
+}
+
+size_t MapFieldType::getAlignment() const
+{
+    return std::alignment_of_v<myl::Map>;
+}
+
 StructFieldType::StructFieldType(const std::string& name)
     : FieldType(FieldType::Struct)
     , name(name)
@@ -339,6 +461,16 @@ void StructFieldType::free(void* /*ptr*/) const
     assert(false && "Unimplemented: struct free");
 }
 
+void StructFieldType::copy(void* /*dst*/, const void* /*src*/) const
+{
+    assert(false && "Unimplemented: struct copy");
+}
+
+bool StructFieldType::isTrivial() const
+{
+    return false;
+}
+
 std::string StructFieldType::asString() const
 {
     return "struct " + name;
@@ -9,13 +9,17 @@
 namespace myl {
 
 struct FieldType {
-    enum Type { Invalid, Error, Builtin, String, Enum, Struct, Array, Vector, Map } fieldType;
+    enum Type { Invalid, Error, Builtin, String, Atom, Enum, Struct, Array, Vector, Map } fieldType;
 
     FieldType(Type fieldType);
     virtual ~FieldType() = default;
 
     virtual void init(void* ptr) const;
     virtual void free(void* ptr) const;
+    // Copy-constructs src into the uninitialized memory at dst. The default is a memcpy.
+    virtual void copy(void* dst, const void* src) const;
+    // Trivial types can be copied with memcpy and don't need init or free
+    virtual bool isTrivial() const;
     virtual std::string asString() const = 0;
     virtual size_t getSize() const;
     virtual size_t getAlignment() const;
@@ -62,6 +66,17 @@ struct StringFieldType : public FieldType {
 
     void init(void* ptr) const override;
     void free(void* ptr) const override;
+    void copy(void* dst, const void* src) const override;
+    bool isTrivial() const override;
+    std::string asString() const override;
+    size_t getSize() const override;
+    size_t getAlignment() const override;
+};
+
+// An interned string (see Atom). Unlike StringFieldType this is trivial.
+struct AtomFieldType : public FieldType {
+    AtomFieldType();
+
     std::string asString() const override;
     size_t getSize() const override;
     size_t getAlignment() const override;
@@ -85,6 +100,8 @@ struct ArrayFieldType : public FieldType {
 
     void init(void* ptr) const override;
     void free(void* ptr) const override;
+    void copy(void* dst, const void* src) const override;
+    bool isTrivial() const override;
     std::string asString() const override;
     size_t getSize() const override;
     size_t getAlignment() const override;
@@ -97,6 +114,8 @@ struct VectorFieldType : public FieldType {
 
     void init(void* ptr) const override;
     void free(void* ptr) const override;
+    void copy(void* dst, const void* src) const override;
+    bool isTrivial() const override;
     std::string asString() const override;
     size_t getSize() const override;
     size_t getAlignment() const override;
@@ -108,9 +127,18 @@ struct MapFieldType : public FieldType {
 
     MapFieldType(std::shared_ptr<FieldType> keyType, std::shared_ptr<FieldType> valueType);
 
+    // Keys are hashed and compared by their bytes, so only types where equal values have equal
+    // bytes work: bool, integers, enums, strings, atoms and arrays of those (no floats, because
+    // of 0.0/-0.0 and NaN).
+    static bool isValidKeyType(const FieldType& type);
+
     void init(void* ptr) const override;
     void free(void* ptr) const override;
+    void copy(void* dst, const void* src) const override;
+    bool isTrivial() const override;
     std::string asString() const override;
+    size_t getSize() const override;
+    size_t getAlignment() const override;
 };
 
 struct StructFieldType : public FieldType {
@@ -120,6 +148,8 @@ struct StructFieldType : public FieldType {
 
     void init(void* ptr) const override;
     void free(void* ptr) const override;
+    void copy(void* dst, const void* src) const override;
+    bool isTrivial() const override;
     std::string asString() const override;
 };
 
@@ -154,6 +184,8 @@ R visit(Func&& func, std::shared_ptr<FieldType>& fieldType)
         return func(std::dynamic_pointer_cast<PrimitiveFieldType>(fieldType));
     case FieldType::String:
         return func(std::dynamic_pointer_cast<StringFieldType>(fieldType));
+    case FieldType::Atom:
+        return func(std::dynamic_pointer_cast<AtomFieldType>(fieldType));
     case FieldType::Enum:
         return func(std::dynamic_pointer_cast<EnumFieldType>(fieldType));
     case FieldType::Struct:
@@ -1,5 +1,8 @@
+#pragma once
+
 #include <cassert>
 #include <limits>
+#include <string>
 
 namespace myl {
 
@@ -28,14 +31,14 @@ public:
         return id_;
     }
 
-    constexpr bool operator==(Id other)
+    constexpr bool operator==(Id other) const
     {
         return id_ == static_cast<Underlying>(other.id_);
     }
 
-    constexpr bool operator!=(Id other)
+    constexpr bool operator!=(Id other) const
     {
-        return id_ == static_cast<Underlying>(other.id_);
+        return id_ != static_cast<Underlying>(other.id_);
     }
 
     std::string toString() const
@@ -0,0 +1,83 @@
+R"luastring"--(
+
+local ffi = require("ffi")
+
+-- Same layout as myl::Atom (atom.hpp). Id 0 is the empty string.
+ffi.cdef [[
+typedef struct {
+    uint32_t id;
+} MylAtom;
+
+typedef uint32_t (*MylInternAtom)(const char* str, size_t size);
+typedef const char* (*MylGetAtom)(uint32_t id, size_t* size);
+]]
+
+local internAtom = ffi.cast("MylInternAtom", myl._internAtom)
+local getAtom = ffi.cast("MylGetAtom", myl._getAtom)
+
+-- Atoms never change and are never freed, so both directions can be cached forever. This way
+-- reading an atom doesn't create a new Lua string every time.
+local atomStrings = {[0] = ""}
+local atomIds = {[""] = 0}
+local sizeOut = ffi.new("size_t[1]")
+
+local function getId(luaString)
+    local id = atomIds[luaString]
+    if not id then
+        id = internAtom(luaString, #luaString)
+        atomIds[luaString] = id
+        atomStrings[id] = luaString
+    end
+    return id
+end
+
+local function getString(id)
+    local luaString = atomStrings[id]
+    if not luaString then
+        local data = getAtom(id, sizeOut)
+        if data == nil then
+            error("Invalid atom id: " .. tostring(id))
+        end
+        luaString = ffi.string(data, sizeOut[0])
+        atomStrings[id] = luaString
+        atomIds[luaString] = id
+    end
+    return luaString
+end
+
+local atom_type = ffi.typeof("MylAtom")
+local atom = {}
+
+function atom.set(a, luaString)
+    a.id = getId(luaString)
+end
+
+function atom.str(a)
+    return getString(a.id)
+end
+
+-- Atoms can be compared with each other or with Lua strings. Strings are compared with the
+-- string of the atom instead of interning them, because atoms are never freed.
+local function equals(a, b)
+    if type(a) == "string" then
+        a, b = b, a
+    end
+    if type(b) == "string" then
+        return getString(a.id) == b
+    end
+    return a.id == b.id
+end
+
+local atom_mt = {
+    __index = atom,
+    __tostring = atom.str,
+    __eq = equals
+}
+
+ffi.metatype(atom_type, atom_mt)
+
+function myl.atom(luaString)
+    return atom_type(getId(luaString))
+end
+
+--)luastring"--"
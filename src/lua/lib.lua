@@ -13,11 +13,54 @@ typedef struct {
 
 void* malloc(size_t size);
 void free(void *ptr);
+
+typedef uint32_t (*MylNewEntities)(size_t count, const size_t* components, size_t componentCount);
+typedef void (*MylDestroyEntities)(const uint32_t* ids, size_t count);
+typedef void (*MylClearComponent)(size_t compId);
 ]]
 
+local newEntities = ffi.cast("MylNewEntities", myl._newEntities)
+local destroyEntities = ffi.cast("MylDestroyEntities", myl._destroyEntities)
+local clearComponent = ffi.cast("MylClearComponent", myl._clearComponent)
+
 myl.c = {}
 myl._componentTypes = {}
 
+-- Creates count entities with the given components in a single call and returns the first id
+-- as a number. The ids are contiguous, so the others are first + 1, .., first + count - 1.
+-- Use myl.toEntityId to pass one of them to the rest of the API.
+function myl.newEntityRange(count, ...)
+    local componentCount = select("#", ...)
+    local components = ffi.new("size_t[?]", componentCount, ...)
+    return newEntities(count, components, componentCount)
+end
+
+-- ids is a uint32_t array of count ids (numbers like the ones from myl.newEntityRange or
+-- myl.entityIdToNumber), which is destroyed in a single call. Ids that don't exist are skipped.
+-- For convenience ids can also be a table of entity ids (like the one myl.newEntities returns).
+function myl.destroyEntities(ids, count)
+    if type(ids) == "table" then
+        myl._destroyEntityTable(ids)
+    else
+        destroyEntities(ids, count)
+    end
+end
+
+-- Convenience wrapper around myl.newEntityRange that returns a table of entity ids. This
+-- creates an object per entity, so use newEntityRange for large numbers of entities.
+function myl.newEntities(count, ...)
+    local first = myl.newEntityRange(count, ...)
+    local ids = {}
+    for i = 1, count do
+        ids[i] = myl.toEntityId(first + i - 1)
+    end
+    return ids
+end
+
+function myl.clearComponent(component)
+    clearComponent(component)
+end
+
 function myl.addComponent(entityId, component)
     return ffi.cast(myl._componentTypes[component], myl._addComponent(entityId, component))[0]
 end
@@ -26,6 +69,26 @@ function myl.getComponent(entityId, component)
     return ffi.cast(myl._componentTypes[component], myl._getComponent(entityId, component))[0]
 end
 
+function myl.getMutableComponent(entityId, component)
+    myl.markChanged(entityId, component)
+    return myl.getComponent(entityId, component)
+end
+
+-- Returns a pointer (use ptr[0]) to a field of a component. This is the only way to access
+-- SoA components (layout = "soa"), because getComponent doesn't work for them.
+function myl.getField(entityId, component, field)
+    return (myl.getFieldColumn(entityId, component, field))
+end
+
+-- Returns a pointer to the field of entityId and how many values follow it. ptr[i] is the
+-- value for entityId + i. For SoA components that's the rest of the page, otherwise it's 1.
+function myl.getFieldColumn(entityId, component, field)
+    local info = myl._fields[component][field]
+    info.ctype = info.ctype or ffi.typeof("$ *", ffi.typeof(info.type))
+    local ptr, count = myl._getFieldColumn(entityId, component, info.index)
+    return ffi.cast(info.ctype, ptr), count
+end
+
 function myl.getComponents(entityId, component, ...)
     if select("#", ...) == 0 then
         return myl.getComponent(entityId, component)
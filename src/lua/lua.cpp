@@ -3,11 +3,15 @@
 #include <cassert>
 #include <filesystem>
 #include <iostream>
+#include <limits>
+#include <unordered_map>
 
 #include "../modules/input.hpp"
 #include "../modules/timer.hpp"
 #include "../modules/tweak.hpp"
 #include "../modules/window.hpp"
+#include "../prefabfile.hpp"
+#include "../util.hpp"
 
 namespace fs = std::filesystem;
 
@@ -25,6 +29,18 @@ static const char mylstring[] =
 #include "string.lua"
 ;
 
+static const char atomlua[] =
+#include "atom.lua"
+;
+
+static const char vectorlua[] =
+#include "vector.lua"
+;
+
+static const char maplua[] =
+#include "map.lua"
+;
+
 static const char vec2lua[] =
 #include "vec2.lua"
 ;
@@ -92,6 +108,8 @@ static const char colorlua[] =
                     return getCTypeName(arg->type);
                 else if constexpr (std::is_same_v<T, StringFieldType>)
                     return "MylString";
+                else if constexpr (std::is_same_v<T, AtomFieldType>)
+                    return "MylAtom";
                 else if constexpr (std::is_same_v<T, EnumFieldType>)
                     return arg->name;
                 else if constexpr (std::is_same_v<T, StructFieldType>)
@@ -99,11 +117,9 @@ static const char colorlua[] =
                 else if constexpr (std::is_same_v<T, ArrayFieldType>)
                     return getCTypeName(arg->elementType) + "[" + std::to_string(arg->size) + "]";
                 else if constexpr (std::is_same_v<T, VectorFieldType>)
-                    return "";
-                // return "MylVector_" + )
-                // assert(false && "VectorFieldType unimplemented");
+                    return "MylVector";
                 else if constexpr (std::is_same_v<T, MapFieldType>)
-                    assert(false && "MapFieldType unimplemented");
+                    return "MylMap";
             },
             fieldType);
     }
@@ -112,14 +128,173 @@ static const char colorlua[] =
     {
         std::stringstream ss;
         ss << "typedef struct {\n";
+        // The fields are sorted by offset and packed bools are at the end, so the C compiler
+        // (LuaJIT) arrives at the same layout.
         for (const auto& field : component.getStruct().getFields()) {
-            ss << "    " << getCTypeName(field.type) << " " << field.name << ";\n";
+            if (field.bit >= 0)
+                ss << "    bool " << field.name << " : 1;\n";
+            else
+                ss << "    " << getCTypeName(field.type) << " " << field.name << ";\n";
         }
         ss << "} " << component.getName();
         return ss.str();
         return "";
     }
 
+    ComponentMask getComponentMask(const sol::table& components)
+    {
+        ComponentMask mask;
+        for (size_t i = 1; i <= components.size(); ++i)
+            mask += ComponentId(components.get<size_t>(i));
+        return mask;
+    }
+
+    template <typename Iterator>
+    auto makeEntityIterator(Iterator it)
+    {
+        return sol::as_function([it](sol::this_state /*L*/) mutable -> std::optional<EntityId> {
+            if (it == typename Iterator::Sentinel {})
+                return std::nullopt;
+            const auto entity = *it;
+            ++it;
+            return entity;
+        });
+    }
+
+    // These are called through the FFI (see lib.lua), so a single call can pass an array.
+    // The new ids are contiguous (see World::newEntities), so only the first one is returned.
+    uint32_t ffiNewEntities(size_t count, const size_t* components, size_t componentCount)
+    {
+        ComponentMask mask;
+        for (size_t i = 0; i < componentCount; ++i)
+            mask += ComponentId(components[i]);
+        return static_cast<uint32_t>(newEntities(count, mask));
+    }
+
+    // The ids come from Lua, so ids that don't exist (anymore) are skipped instead of freeing
+    // whatever entity has that index now. Duplicates don't exist anymore after the first one.
+    void ffiDestroyEntities(const uint32_t* ids, size_t count)
+    {
+        for (size_t i = 0; i < count; ++i) {
+            const auto id = EntityId(ids[i]);
+            if (entityExists(id))
+                destroyEntity(id);
+        }
+    }
+
+    // Negative, NaN and too large keys would be undefined as uint64_t, so they are clamped
+    uint64_t toSortKey(double key)
+    {
+        if (!(key > 0.0))
+            return 0;
+        if (key >= 18446744073709551616.0) // 2^64
+            return std::numeric_limits<uint64_t>::max();
+        return static_cast<uint64_t>(key);
+    }
+
+    /*
+     * Lua numbers are doubles, which only hold 53 bits exactly, so the coordinates are clamped
+     * to [0, 2^26) and the code is below 2^52. That's still plenty for positions in pixels or
+     * grid cells.
+     */
+    double luaMortonCode(double x, double y)
+    {
+        constexpr double maxCoord = (1 << 26) - 1;
+        const auto clamp = [](double v) {
+            return static_cast<uint32_t>(v > 0.0 ? (v < maxCoord ? v : maxCoord) : 0.0);
+        };
+        return static_cast<double>(mortonCode(clamp(x), clamp(y)));
+    }
+
+    void ffiClearComponent(size_t compId)
+    {
+        clearComponent(ComponentId(compId));
+    }
+
+    // Strings set from Lua have to come from the same allocator as the C++ ones
+    void* ffiAllocate(size_t size)
+    {
+        return getFieldAllocator().allocate(size);
+    }
+
+    void ffiDeallocate(void* ptr, size_t size)
+    {
+        getFieldAllocator().deallocate(ptr, size);
+    }
+
+    uint32_t ffiInternAtom(const char* str, size_t size)
+    {
+        return Atom(str, size).getId();
+    }
+
+    // The id comes from Lua (it's just a field in a cdata), so it's not trusted
+    const char* ffiGetAtom(uint32_t id, size_t* size)
+    {
+        if (!Atom::isValidId(id)) {
+            *size = 0;
+            return nullptr;
+        }
+        const auto atom = Atom::fromId(id);
+        *size = atom.getSize();
+        return atom.getData();
+    }
+
+    // Lookups in maps go through the FFI too, so they don't need sol2 (see map.lua)
+    enum class MapOp { Find, Insert, Erase };
+    enum class MapKeyKind { Number, String, Bytes };
+
+    void* ffiMapAccess(
+        Map* map, int op, int keyKind, const void* keyData, size_t keySize, double number)
+    {
+        uint64_t buffer = 0;
+        std::optional<std::string_view> key;
+        switch (static_cast<MapKeyKind>(keyKind)) {
+        case MapKeyKind::Number:
+            key = map->makeKey(number, buffer);
+            break;
+        case MapKeyKind::String:
+            key = map->makeKey(
+                std::string_view(reinterpret_cast<const char*>(keyData), keySize), buffer);
+            break;
+        case MapKeyKind::Bytes: {
+            // keySize is ffi.sizeof of whatever Lua passed, so it has to match exactly.
+            // String keys are only passed as characters (MapKeyKind::String).
+            const auto& keyType = *map->getType()->keyType;
+            if (keyType.fieldType == FieldType::String || keySize != keyType.getSize())
+                return nullptr;
+            key = std::string_view(reinterpret_cast<const char*>(keyData), keySize);
+            break;
+        }
+        }
+        if (!key)
+            return nullptr;
+        switch (static_cast<MapOp>(op)) {
+        case MapOp::Find:
+            return map->find(*key);
+        case MapOp::Insert:
+            return map->insert(*key);
+        case MapOp::Erase:
+            // Anything but nullptr means it was erased
+            return map->erase(*key) ? map : nullptr;
+        }
+        return nullptr;
+    }
+
+    void ffiMapTypes(const Map* map, const char** keyType, const char** valueType)
+    {
+        // The names have to stay alive, so they are cached per map type
+        static std::unordered_map<const MapFieldType*, std::pair<std::string, std::string>> names;
+        const auto type = map->getType();
+        auto it = names.find(type);
+        if (it == names.end()) {
+            auto typeNames
+                = std::make_pair(getCTypeName(type->keyType), getCTypeName(type->valueType));
+            it = names.emplace(type, std::move(typeNames)).first;
+        }
+        *keyType = it->second.first.c_str();
+        *valueType = it->second.second.c_str();
+    }
+
     void addWindowModule(sol::state& lua)
     {
         auto window = lua["myl"]["service"]["window"] = lua.create_table();
@@ -312,24 +487,91 @@ static const char colorlua[] =
 
         auto myl = lua_.create_named_table("myl");
 
+        myl["setStorage"].set_function([this](const std::string& storage) {
+            if (storage == "pools")
+                world_.setStorage(World::Storage::Pools);
+            else if (storage == "archetypes")
+                world_.setStorage(World::Storage::Archetypes);
+            else
+                std::cerr << "Unknown storage '" << storage << "'" << std::endl;
+        });
+
         myl["entityExists"].set_function(entityExists);
+        myl["reserveEntities"].set_function(reserveEntities);
         myl["newEntity"].set_function(newEntity);
         myl["destroyEntity"].set_function(destroyEntity);
-
-        myl["foreachEntity"].set_function([](sol::variadic_args va) {
-            ComponentMask mask;
-            for (auto v : va)
-                mask += ComponentId(v.as<size_t>());
-            const auto entities = getEntities(mask);
-
-            size_t index = 0;
-            return sol::as_function(
-                [entities, index](sol::this_state /*L*/) mutable -> std::optional<EntityId> {
-                    if (index < entities.size())
-                        return entities[index++];
+        // Only for the table convenience wrapper of myl.destroyEntities (see lib.lua)
+        myl["_destroyEntityTable"].set_function([](const sol::table& table) {
+            for (size_t i = 1; i <= table.size(); ++i) {
+                const auto id = table.get<EntityId>(i);
+                if (entityExists(id))
+                    destroyEntity(id);
+            }
+        });
+        // Entity ids are userdata, so they need to be converted to pass them through the FFI
+        myl["entityIdToNumber"].set_function(
+            [](EntityId id) { return static_cast<uint32_t>(id); });
+        myl["toEntityId"].set_function([](uint32_t value) { return EntityId(value); });
+        myl["destroyAllEntities"].set_function(
+            [](sol::optional<bool> freeFields) { destroyAllEntities(freeFields.value_or(true)); });
+        myl["beginFieldArena"].set_function(beginFieldArena);
+        myl["endFieldArena"].set_function(endFieldArena);
+        // key is an optional function that takes an entity and returns a number to sort by.
+        // Returns a function that translates an old id to the new one (or nil).
+        myl["compact"].set_function([](sol::optional<sol::function> key) {
+            std::function<uint64_t(EntityId)> sortKey;
+            if (key) {
+                sortKey = [key = *key](EntityId id) {
+                    return toSortKey(key(id).get<double>());
+                };
+            }
+            const auto remap = compact(sortKey);
+            return sol::as_function([remap](EntityId id) -> std::optional<EntityId> {
+                const auto newId = remap.get(id);
+                if (newId == maxId<EntityId>())
                     return std::nullopt;
-                });
+                return newId;
+            });
         });
+        myl["mortonCode"].set_function(luaMortonCode);
+
+        myl["_newEntities"] = sol::lightuserdata_value(reinterpret_cast<void*>(&ffiNewEntities));
+        myl["_destroyEntities"]
+            = sol::lightuserdata_value(reinterpret_cast<void*>(&ffiDestroyEntities));
+        myl["_clearComponent"]
+            = sol::lightuserdata_value(reinterpret_cast<void*>(&ffiClearComponent));
+        myl["_allocate"] = sol::lightuserdata_value(reinterpret_cast<void*>(&ffiAllocate));
+        myl["_deallocate"] = sol::lightuserdata_value(reinterpret_cast<void*>(&ffiDeallocate));
+        myl["_mapAccess"] = sol::lightuserdata_value(reinterpret_cast<void*>(&ffiMapAccess));
+        myl["_mapTypes"] = sol::lightuserdata_value(reinterpret_cast<void*>(&ffiMapTypes));
+        myl["_internAtom"] = sol::lightuserdata_value(reinterpret_cast<void*>(&ffiInternAtom));
+        myl["_getAtom"] = sol::lightuserdata_value(reinterpret_cast<void*>(&ffiGetAtom));
+
+        myl["foreachEntity"].set_function(sol::overload(
+            [](QueryId query) { return makeEntityIterator(foreachEntity(query).begin()); },
+            [](sol::variadic_args va) {
+                ComponentMask mask;
+                for (auto v : va)
+                    mask += ComponentId(v.as<size_t>());
+                return makeEntityIterator(foreachEntity(mask).begin());
+            }));
+
+        // myl.foreachChanged(tick, changedComponent, otherComponents...)
+        myl["foreachChanged"].set_function(
+            [](uint32_t tick, size_t changed, sol::variadic_args va) {
+                ComponentMask mask;
+                for (auto v : va)
+                    mask += ComponentId(v.as<size_t>());
+                const auto filter = ChangeFilter { ComponentId(changed), tick };
+                return makeEntityIterator(foreachEntity(mask, filter).begin());
+            });
+
+        myl["registerQuery"].set_function(
+            [](sol::table include, sol::optional<sol::table> exclude) -> QueryId {
+                const auto excludeMask = exclude ? getComponentMask(*exclude) : ComponentMask();
+                return registerQuery(getComponentMask(include), excludeMask);
+            });
+        myl["unregisterQuery"].set_function(unregisterQuery);
 
         myl["removeComponent"].set_function(removeComponent);
         myl["hasComponent"].set_function(hasComponent);
@@ -342,6 +584,15 @@ static const char colorlua[] =
             [](EntityId entityId, size_t compId) -> sol::lightuserdata_value {
                 return getComponent(entityId, ComponentId(compId));
             });
+        myl["_getFieldColumn"].set_function([](EntityId entityId, size_t compId, size_t field) {
+            const auto column = getFieldColumnBuffer(entityId, ComponentId(compId), field);
+            return std::make_tuple(sol::lightuserdata_value(column.data), column.count);
+        });
+
+        myl["getTick"].set_function(getTick);
+        myl["advanceTick"].set_function(advanceTick);
+        myl["markChanged"].set_function(
+            [](EntityId entityId, size_t compId) { markChanged(entityId, ComponentId(compId)); });
 
         myl["setComponentEnabled"].set_function(sol::overload(
             [](EntityId id, ComponentId compId) -> void {
@@ -373,12 +624,27 @@ static const char colorlua[] =
             registeredSystems_.emplace_back(name);
         });
         myl["invokeSystem"].set_function(invokeSystem);
+        myl["invokeSystems"].set_function([](sol::table names, float dt) {
+            std::vector<std::string> systemNames;
+            for (size_t i = 1; i <= names.size(); ++i)
+                systemNames.push_back(names.get<std::string>(i));
+            invokeSystems(systemNames, dt);
+        });
 
         myl["loadComponents"].set_function(
             static_cast<void (*)(const std::string&)>(myl::loadComponents));
+        myl["loadPrefabs"].set_function(
+            static_cast<void (*)(const std::string&)>(myl::loadPrefabs));
+        // Returns the first entity, the others follow contiguously
+        myl["instantiate"].set_function([](const std::string& name, sol::optional<size_t> count) {
+            return getPrefab(name).instantiate(count.value_or(1));
+        });
 
         lua_.script(liblua);
         lua_.script(mylstring);
+        lua_.script(atomlua);
+        lua_.script(vectorlua);
+        lua_.script(maplua);
         lua_.script(vec2lua);
         lua_.script(vec3lua);
         lua_.script(vec4lua);
@@ -395,6 +661,7 @@ static const char colorlua[] =
 
         myl["c"] = lua_.create_table();
         myl["_componentTypes"] = lua_.create_table();
+        myl["_fields"] = lua_.create_table();
         for (const auto& component : getComponents())
             componentRegistered(lua_, component);
 
@@ -425,6 +692,16 @@ static const char colorlua[] =
         const auto id = static_cast<size_t>(getComponentId(name));
         lua["myl"]["c"][name] = id;
         lua["myl"]["_componentTypes"][id] = name + "*";
+
+        // For getField/getFieldColumn in lib.lua
+        auto fields = lua.create_table();
+        const auto& structFields = component.getStruct().getFields();
+        for (size_t i = 0; i < structFields.size(); ++i) {
+            if (structFields[i].bit < 0)
+                fields[structFields[i].name] = lua.create_table_with(
+                    "index", i, "type", getCTypeName(structFields[i].type));
+        }
+        lua["myl"]["_fields"][id] = fields;
     }
 
     int State::exceptionHandler(lua_State* L,
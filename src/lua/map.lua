@@ -0,0 +1,133 @@
+R"luastring"--(
+
+local ffi = require("ffi")
+
+-- Same layout as myl::Map (structmap.hpp). Control bytes < 0x80 are full slots.
+ffi.cdef [[
+typedef struct {
+    uint8_t* ctrl;
+    uint8_t* slots;
+    uint32_t size;
+    uint32_t capacity;
+    uint32_t growthLeft;
+    uint32_t slotSize;
+    uint32_t valueOffset;
+    const void* type;
+} MylMap;
+
+typedef void* (*MylMapAccess)(MylMap* map, int op, int keyKind, const void* key, size_t keySize,
+    double number);
+typedef void (*MylMapTypes)(const MylMap* map, const char** keyType, const char** valueType);
+]]
+
+local mapAccess = ffi.cast("MylMapAccess", myl._mapAccess)
+local mapTypes = ffi.cast("MylMapTypes", myl._mapTypes)
+
+-- See MapOp and MapKeyKind in lua.cpp
+local opFind, opInsert, opErase = 0, 1, 2
+local keyNumber, keyString, keyBytes = 0, 1, 2
+
+local map_type = ffi.typeof("MylMap")
+local string_type = ffi.typeof("MylString")
+local atom_type = ffi.typeof("MylAtom")
+local typeNamesOut = ffi.new("const char*[2]")
+-- Pointer types of the keys and values per map type
+local typeCache = {}
+
+local function getTypes(m)
+    local typeId = tonumber(ffi.cast("uintptr_t", m.type))
+    local types = typeCache[typeId]
+    if not types then
+        mapTypes(m, typeNamesOut, typeNamesOut + 1)
+        types = {
+            key = ffi.typeof("$*", ffi.typeof(ffi.string(typeNamesOut[0]))),
+            value = ffi.typeof("$*", ffi.typeof(ffi.string(typeNamesOut[1]))),
+        }
+        typeCache[typeId] = types
+    end
+    return types
+end
+
+-- Keys can be numbers, booleans, strings (also for atom keys) or cdata of the key type.
+-- MylString and MylAtom are passed as their characters, so they work for both kinds of keys.
+-- Other cdata with the wrong size is rejected (the access returns nil).
+local function access(m, op, key)
+    local keyType = type(key)
+    if keyType == "cdata" and (ffi.istype(string_type, key) or ffi.istype(atom_type, key)) then
+        key = key:str()
+        keyType = "string"
+    end
+    if keyType == "number" then
+        return mapAccess(m, op, keyNumber, nil, 0, key)
+    elseif keyType == "boolean" then
+        return mapAccess(m, op, keyNumber, nil, 0, key and 1 or 0)
+    elseif keyType == "string" then
+        return mapAccess(m, op, keyString, key, #key, 0)
+    end
+    return mapAccess(m, op, keyBytes, key, ffi.sizeof(key), 0)
+end
+
+local map = {}
+
+-- Returns a pointer to the value or nil
+function map.find(m, key)
+    local ptr = access(m, opFind, key)
+    if ptr == nil then
+        return nil
+    end
+    return ffi.cast(getTypes(m).value, ptr)
+end
+
+-- Returns the value (numbers for number values) or nil
+function map.get(m, key)
+    local ptr = map.find(m, key)
+    if ptr then
+        return ptr[0]
+    end
+    return nil
+end
+
+-- Returns a pointer to the value, which is newly initialized if the key is new
+function map.insert(m, key)
+    local ptr = access(m, opInsert, key)
+    if ptr == nil then
+        error("Invalid key for this map: " .. tostring(key))
+    end
+    return ffi.cast(getTypes(m).value, ptr)
+end
+
+-- Only for values that can be assigned directly (not for strings, use insert(key)[0]:set())
+function map.set(m, key, value)
+    map.insert(m, key)[0] = value
+end
+
+function map.erase(m, key)
+    return access(m, opErase, key) ~= nil
+end
+
+-- for key, valuePtr in m:pairs() do
+function map.pairs(m)
+    local types = getTypes(m)
+    local i = -1
+    return function()
+        repeat
+            i = i + 1
+        until i >= m.capacity or m.ctrl[i] < 0x80
+        if i >= m.capacity then
+            return nil
+        end
+        local slot = m.slots + i * m.slotSize
+        return ffi.cast(types.key, slot)[0], ffi.cast(types.value, slot + m.valueOffset)
+    end
+end
+
+local map_mt = {
+    __index = map,
+    __len = function(m)
+        return m.size
+    end
+}
+
+ffi.metatype(map_type, map_mt)
+
+--)luastring"--"
@@ -4,31 +4,69 @@ local ffi = require("ffi")
 
 local max = math.max
 
+-- Same layout as myl::String (structstring.hpp): strings shorter than inlineCapacity are stored
+-- in the struct itself and the tag is their size. Heap strings have tag == heapTag.
 ffi.cdef [[
 typedef struct {
     char* data;
     size_t size;
-    size_t capacity;
+    uint32_t capacity;
+    uint8_t padding[3];
+    uint8_t tag;
 } MylString;
+
+typedef void* (*MylAllocate)(size_t size);
+typedef void (*MylDeallocate)(void* ptr, size_t size);
 ]]
 
+-- The heap buffers are freed by C++, so they have to come from the field allocator
+local allocate = ffi.cast("MylAllocate", myl._allocate)
+local deallocate = ffi.cast("MylDeallocate", myl._deallocate)
+
+local inlineCapacity = 23
+local heapTag = 0xff
+
 local str_type = ffi.typeof("MylString")
+local char_ptr = ffi.typeof("char*")
 local str = {}
 
 function str.set(s, luaString)
     local len = luaString:len()
-    if s.capacity < len + 1 then
-        ffi.C.free(s.data)
-        local allocSize = max(32, max(tonumber(s.capacity * 2), len + 1))
-        s.data = ffi.C.malloc(allocSize)
+    if s.tag ~= heapTag and len < inlineCapacity then
+        local buf = ffi.cast(char_ptr, s)
+        ffi.copy(buf, luaString, len)
+        buf[len] = 0
+        s.tag = len
+        return
+    end
+
+    local capacity = s.tag == heapTag and s.capacity or inlineCapacity
+    if capacity < len + 1 then
+        local allocSize = max(32, max(capacity * 2, len + 1))
+        local data = allocate(allocSize)
+        if s.tag == heapTag then
+            deallocate(s.data, s.capacity)
+        end
+        s.data = data
         s.capacity = allocSize
+        s.tag = heapTag
     end
     ffi.copy(s.data, luaString, len)
     s.data[len] = 0
     s.size = len
 end
 
+function str.size(s)
+    if s.tag ~= heapTag then
+        return s.tag
+    end
+    return tonumber(s.size)
+end
+
 function str.str(s)
+    if s.tag ~= heapTag then
+        return ffi.string(ffi.cast(char_ptr, s), s.tag)
+    end
     return ffi.string(s.data, s.size)
 end
 
@@ -0,0 +1,47 @@
+R"luastring"--(
+
+local ffi = require("ffi")
+
+-- Same layout as myl::Vector (structvector.hpp). Elements that fit into inlineSize bytes are
+-- stored in place of the data pointer.
+ffi.cdef [[
+typedef struct {
+    union {
+        uint8_t* data;
+        uint8_t inlineData[16];
+    };
+    size_t size;
+    size_t capacity;
+    const void* elementType;
+} MylVector;
+]]
+
+local inlineSize = 16
+
+local vec_type = ffi.typeof("MylVector")
+local ptrTypes = {}
+local vector = {}
+
+-- The vector doesn't know the C type of its elements, so it has to be passed (e.g. "uint32_t").
+-- Returns a pointer to the first element, the elements are 0 to #v - 1. Resizing is only possible
+-- from C++.
+function vector.data(v, elementType)
+    local ptrType = ptrTypes[elementType]
+    if not ptrType then
+        ptrType = ffi.typeof("$*", ffi.typeof(elementType))
+        ptrTypes[elementType] = ptrType
+    end
+    local inline = tonumber(v.capacity) * ffi.sizeof(elementType) <= inlineSize
+    return ffi.cast(ptrType, inline and v.inlineData or v.data)
+end
+
+local vec_mt = {
+    __index = vector,
+    __len = function(v)
+        return tonumber(v.size)
+    end
+}
+
+ffi.metatype(vec_type, vec_mt)
+
+--)luastring"--"
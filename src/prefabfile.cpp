@@ -0,0 +1,233 @@
+#include "prefabfile.hpp"
+
+#include <cstdlib>
+#include <fstream> //required for toml::parse_file()
+#include <iostream>
+
+#include <toml++/toml.h>
+
+#include "color.hpp"
+#include "fieldtype.hpp"
+#include "structstring.hpp"
+#include "structvector.hpp"
+
+namespace myl {
+
+namespace {
+    template <typename T>
+    bool setNumber(void* ptr, const toml::node& node)
+    {
+        if constexpr (std::is_floating_point_v<T>) {
+            const auto value = node.value<double>();
+            if (value)
+                *reinterpret_cast<T*>(ptr) = static_cast<T>(*value);
+            return value.has_value();
+        } else {
+            const auto value = node.value<int64_t>();
+            if (value)
+                *reinterpret_cast<T*>(ptr) = static_cast<T>(*value);
+            return value.has_value();
+        }
+    }
+
+    bool setFloats(void* ptr, const toml::node& node, size_t count)
+    {
+        const auto arr = node.as_array();
+        if (!arr || arr->size() != count)
+            return false;
+        for (size_t i = 0; i < count; ++i) {
+            if (!setNumber<float>(reinterpret_cast<float*>(ptr) + i, (*arr)[i]))
+                return false;
+        }
+        return true;
+    }
+
+    bool setPrimitive(const PrimitiveFieldType& type, void* ptr, const toml::node& node)
+    {
+        switch (type.type) {
+        case PrimitiveFieldType::Bool: {
+            const auto value = node.value<bool>();
+            if (value)
+                *reinterpret_cast<bool*>(ptr) = *value;
+            return value.has_value();
+        }
+        case PrimitiveFieldType::U8:
+            return setNumber<uint8_t>(ptr, node);
+        case PrimitiveFieldType::I8:
+            return setNumber<int8_t>(ptr, node);
+        case PrimitiveFieldType::U16:
+            return setNumber<uint16_t>(ptr, node);
+        case PrimitiveFieldType::I16:
+            return setNumber<int16_t>(ptr, node);
+        case PrimitiveFieldType::U32:
+            return setNumber<uint32_t>(ptr, node);
+        case PrimitiveFieldType::I32:
+            return setNumber<int32_t>(ptr, node);
+        case PrimitiveFieldType::U64:
+            return setNumber<uint64_t>(ptr, node);
+        case PrimitiveFieldType::I64:
+            return setNumber<int64_t>(ptr, node);
+        case PrimitiveFieldType::F32:
+            return setNumber<float>(ptr, node);
+        case PrimitiveFieldType::Vec2:
+            return setFloats(ptr, node, 2);
+        case PrimitiveFieldType::Vec3:
+            return setFloats(ptr, node, 3);
+        case PrimitiveFieldType::Vec4:
+            return setFloats(ptr, node, 4);
+        case PrimitiveFieldType::Color:
+            // Either [r, g, b, a] or "#rrggbb(aa)"
+            if (const auto str = node.as_string()) {
+                auto hex = str->get();
+                if (hex.size() > 0 && hex[0] == '#')
+                    hex = hex.substr(1);
+                if (hex.size() != 6 && hex.size() != 8)
+                    return false;
+                char* end = nullptr;
+                auto value = static_cast<uint32_t>(std::strtoul(hex.c_str(), &end, 16));
+                if (end != hex.c_str() + hex.size())
+                    return false;
+                if (hex.size() == 6)
+                    value = (value << 8) | 0xff;
+                *reinterpret_cast<Color*>(ptr) = Color(value);
+                return true;
+            }
+            return setFloats(ptr, node, 4);
+        default:
+            return false;
+        }
+    }
+
+    bool setValue(const FieldType& type, void* ptr, const toml::node& node)
+    {
+        switch (type.fieldType) {
+        case FieldType::Builtin:
+            return setPrimitive(dynamic_cast<const PrimitiveFieldType&>(type), ptr, node);
+        case FieldType::String: {
+            const auto str = node.as_string();
+            if (str)
+                reinterpret_cast<String*>(ptr)->assign(str->get());
+            return str;
+        }
+        case FieldType::Atom: {
+            const auto str = node.as_string();
+            if (str)
+                *reinterpret_cast<Atom*>(ptr) = Atom(str->get());
+            return str;
+        }
+        case FieldType::Enum:
+            // The names of the values are not available here anymore
+            return setNumber<int>(ptr, node);
+        case FieldType::Array: {
+            const auto& arrayType = dynamic_cast<const ArrayFieldType&>(type);
+            const auto arr = node.as_array();
+            if (!arr || arr->size() != arrayType.size)
+                return false;
+            const auto elemSize = arrayType.elementType->getSize();
+            for (size_t i = 0; i < arrayType.size; ++i) {
+                const auto elem = reinterpret_cast<uint8_t*>(ptr) + i * elemSize;
+                if (!setValue(*arrayType.elementType, elem, (*arr)[i]))
+                    return false;
+            }
+            return true;
+        }
+        case FieldType::Vector: {
+            const auto arr = node.as_array();
+            if (!arr)
+                return false;
+            auto& vec = *reinterpret_cast<Vector*>(ptr);
+            vec.resize(arr->size());
+            const auto& elementType = *dynamic_cast<const VectorFieldType&>(type).elementType;
+            for (size_t i = 0; i < arr->size(); ++i) {
+                if (!setValue(elementType, vec.getPointer(i), (*arr)[i]))
+                    return false;
+            }
+            return true;
+        }
+        case FieldType::Map: {
+            // Map keys are the table keys, which are always strings in TOML
+            const auto tbl = node.as_table();
+            if (!tbl)
+                return false;
+            auto& map = *reinterpret_cast<Map*>(ptr);
+            const auto& valueType = *dynamic_cast<const MapFieldType&>(type).valueType;
+            for (const auto& [tomlKey, value] : *tbl) {
+                uint64_t buffer = 0;
+                const auto key = map.makeKey(std::string_view(tomlKey), buffer);
+                if (!key || !setValue(valueType, map.insert(*key), value))
+                    return false;
+            }
+            return true;
+        }
+        default:
+            return false;
+        }
+    }
+}
+
+void loadPrefabs(World& world, std::string_view path)
+{
+    toml::table tbl;
+    try {
+        tbl = toml::parse_file(path);
+    } catch (const toml::parse_error& err) {
+        std::cerr << "Error parsing file '" << *err.source().path << "':\n"
+                  << err.description() << "\n  (" << err.source().begin << ")\n";
+        return;
+    }
+
+    if (!tbl["prefabs"])
+        return;
+
+    for (const auto& prefabNode : *tbl["prefabs"].as_array()) {
+        const auto& prefabTable = *prefabNode.as_table();
+        const auto name = prefabTable["name"].as_string()->get();
+        Prefab prefab(world);
+
+        if (prefabTable["components"]) {
+            for (const auto& componentNode : *prefabTable["components"].as_array()) {
+                const auto& componentTable = *componentNode.as_table();
+                const auto componentName = componentTable["name"].as_string()->get();
+                const auto compId = world.findComponentId(componentName);
+                if (!compId) {
+                    std::cerr << "Unknown component '" << componentName << "' in prefab '" << name
+                              << "'" << std::endl;
+                    continue;
+                }
+                const auto& strct = world.getComponent(*compId).getStruct();
+                auto ptr = reinterpret_cast<uint8_t*>(prefab.addComponentBuffer(*compId));
+
+                const auto values = componentTable["values"].as_table();
+                if (!values)
+                    continue;
+                for (const auto& field : strct.getFields()) {
+                    const auto node = (*values)[field.name].node();
+                    if (node && field.bit >= 0) {
+                        bool value = false;
+                        if (setValue(*field.type, &value, *node))
+                            field.setBit(ptr, value);
+                        else
+                            std::cerr << "Invalid value for '" << componentName << "."
+                                      << field.name << "' in prefab '" << name << "'" << std::endl;
+                    } else if (node && !setValue(*field.type, ptr + field.offset, *node))
+                        std::cerr << "Invalid value for '" << componentName << "." << field.name
+                                  << "' (" << field.type->asString() << ") in prefab '" << name
+                                  << "'" << std::endl;
+                }
+            }
+        }
+
+        if (world.hasPrefab(name)) {
+            std::cerr << "Prefab '" << name << "' is already registered" << std::endl;
+            continue;
+        }
+        world.registerPrefab(name, std::move(prefab));
+    }
+}
+
+void loadPrefabs(const std::string& path)
+{
+    loadPrefabs(getDefaultWorld(), path);
+}
+
+}
@@ -0,0 +1,18 @@
+#pragma once
+
+#include "ecs.hpp"
+
+namespace myl {
+/*
+ * Loads prefabs from a TOML file (usually prefabs.toml next to components.toml) and
+ * registers them in the world. The components have to be registered already.
+ * [[prefabs]]
+ * name = "Bullet"
+ * components = [
+ *     {name = "Transform", values = {scale = [1.0, 1.0]}},
+ *     {name = "Velocity", values = {value = [0.0, 300.0]}},
+ * ]
+ */
+void loadPrefabs(World& world, std::string_view path);
+void loadPrefabs(const std::string& path);
+}
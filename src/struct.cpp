@@ -2,6 +2,7 @@
 
 #include <algorithm>
 #include <cassert>
+#include <cstring>
 
 namespace myl {
 
@@ -20,60 +21,167 @@ size_t Struct::getAlignment() const
     return alignment_;
 }
 
+bool Struct::isTrivial() const
+{
+    return ops_.empty();
+}
+
 void Struct::init(void* ptr) const
 {
-    // I can theoretically do this once in an empty buffer and then just copy it over each time
-    for (const auto& field : fields_)
-        field.type->init(reinterpret_cast<uint8_t*>(ptr) + field.offset);
+    if (ops_.empty())
+        return;
+    std::memcpy(ptr, prototype_.data(), size_);
+    const auto bytes = reinterpret_cast<uint8_t*>(ptr);
+    for (const auto& op : initOps_)
+        op.type->init(bytes + op.offset);
 }
 
 void Struct::free(void* ptr) const
 {
-    for (const auto& field : fields_)
-        field.type->free(reinterpret_cast<uint8_t*>(ptr) + field.offset);
+    const auto bytes = reinterpret_cast<uint8_t*>(ptr);
+    for (const auto& op : ops_) {
+        switch (op.kind) {
+        case Op::String:
+            reinterpret_cast<myl::String*>(bytes + op.offset)->~String();
+            break;
+        case Op::Vector:
+            reinterpret_cast<myl::Vector*>(bytes + op.offset)->~Vector();
+            break;
+        default:
+            op.type->free(bytes + op.offset);
+        }
+    }
+}
+
+void Struct::copy(void* dst, const void* src) const
+{
+    std::memcpy(dst, src, size_);
+    const auto dstBytes = reinterpret_cast<uint8_t*>(dst);
+    const auto srcBytes = reinterpret_cast<const uint8_t*>(src);
+    for (const auto& op : ops_) {
+        switch (op.kind) {
+        case Op::String:
+            new (dstBytes + op.offset)
+                myl::String(*reinterpret_cast<const myl::String*>(srcBytes + op.offset));
+            break;
+        case Op::Vector:
+            new (dstBytes + op.offset)
+                myl::Vector(*reinterpret_cast<const myl::Vector*>(srcBytes + op.offset));
+            break;
+        default:
+            op.type->copy(dstBytes + op.offset, srcBytes + op.offset);
+        }
+    }
 }
 
 Struct::Struct(const std::vector<Field>& fields, size_t size, size_t alignment)
     : fields_(std::move(fields))
     , size_(size)
     , alignment_(alignment)
+    , prototype_(size, 0)
 {
+    for (const auto& field : fields_) {
+        if (field.bit < 0)
+            compile(*field.type, field.offset);
+    }
 }
 
-constexpr size_t padding(size_t offset, size_t alignment)
+void Struct::compile(const FieldType& type, size_t offset)
 {
-    const auto misalignment = offset % alignment;
-    return misalignment > 0 ? alignment - misalignment : 0;
+    if (type.isTrivial())
+        return;
+    assert(offset <= UINT32_MAX);
+    const auto off = static_cast<uint32_t>(offset);
+    switch (type.fieldType) {
+    case FieldType::String:
+        // Short strings are stored inline and an empty string is all zeros, so the prototype
+        // already contains a valid empty string
+        ops_.push_back(Op { Op::String, off, &type });
+        break;
+    case FieldType::Vector:
+        // An empty vector doesn't own anything, so it can just be copied from the prototype
+        type.init(prototype_.data() + offset);
+        ops_.push_back(Op { Op::Vector, off, &type });
+        break;
+    case FieldType::Map:
+        // Same as vectors, an empty map doesn't allocate
+        type.init(prototype_.data() + offset);
+        ops_.push_back(Op { Op::Other, off, &type });
+        break;
+    case FieldType::Array: {
+        const auto& arrayType = dynamic_cast<const ArrayFieldType&>(type);
+        const auto elemSize = arrayType.elementType->getSize();
+        for (size_t i = 0; i < arrayType.size; ++i)
+            compile(*arrayType.elementType, offset + i * elemSize);
+        break;
+    }
+    default:
+        initOps_.push_back(Op { Op::Other, off, &type });
+        ops_.push_back(Op { Op::Other, off, &type });
+    }
 }
 
-constexpr size_t align(size_t offset, size_t alignment)
+StructBuilder::StructBuilder()
+    : packing_(Packing::None)
 {
-    return offset + padding(offset, alignment);
 }
 
-StructBuilder::StructBuilder()
-    : currentOffset_(0)
+void StructBuilder::setPacking(Packing packing)
 {
+    packing_ = packing;
 }
 
 void StructBuilder::addField(const std::string& name, std::shared_ptr<FieldType> type)
 {
     const auto size = type->getSize();
     const auto alignment = type->getAlignment();
-    currentOffset_ = align(currentOffset_, alignment);
-    fields_.emplace_back(Struct::Field { name, type, currentOffset_, size, alignment });
-    currentOffset_ += size;
+    // The offsets are determined in build
+    fields_.emplace_back(Struct::Field { name, type, 0, size, alignment });
 }
 
 Struct StructBuilder::build() const
 {
-    const auto alignment
-        = std::max_element(fields_.begin(), fields_.end(), [](const auto& lhs, const auto& rhs) {
-              return lhs.alignment < rhs.alignment;
-          })->alignment;
-    const auto size = align(currentOffset_, alignment);
+    const auto isBool = [](const Struct::Field& field) {
+        return field.type->fieldType == FieldType::Builtin
+            && dynamic_cast<const PrimitiveFieldType&>(*field.type).type
+            == PrimitiveFieldType::Bool;
+    };
+
+    auto fields = fields_;
+    if (packing_ != Packing::None) {
+        std::stable_sort(fields.begin(), fields.end(), [](const auto& lhs, const auto& rhs) {
+            return lhs.alignment > rhs.alignment;
+        });
+    }
+    if (packing_ == Packing::Bits) {
+        std::stable_partition(
+            fields.begin(), fields.end(), [&isBool](const auto& field) { return !isBool(field); });
+    }
+
+    size_t offset = 0;
+    size_t bit = 0;
+    for (auto& field : fields) {
+        if (packing_ == Packing::Bits && isBool(field)) {
+            // The bits are at the end, so we simply have to start a new byte every 8 bits
+            if (bit % 8 == 0)
+                offset++;
+            field.offset = offset - 1;
+            field.bit = static_cast<int>(bit % 8);
+            bit++;
+            continue;
+        }
+        offset = align(offset, field.alignment);
+        field.offset = offset;
+        offset += field.size;
+    }
+
+    // Structs without fields have size 0 (tag components)
+    size_t alignment = 1;
+    for (const auto& field : fields)
+        alignment = std::max(alignment, field.alignment);
+    const auto size = align(offset, alignment);
 
-    return Struct { fields_, size, alignment };
+    return Struct { fields, size, alignment };
 }
 
 }
@@ -2,8 +2,10 @@
 
 #include <glm/glm.hpp>
 
+#include "atom.hpp"
 #include "color.hpp"
 #include "fieldtype.hpp"
+#include "structmap.hpp"
 #include "structstring.hpp"
 #include "structvector.hpp"
 
@@ -27,36 +29,89 @@ public:
         size_t offset;
         size_t size;
         size_t alignment;
+        // Bools packed into bits (see StructBuilder::Packing) have bit >= 0 and live in the
+        // byte at offset. They can't be accessed through a bool*, use getBit/setBit.
+        int bit = -1;
+
+        bool getBit(const void* structPtr) const
+        {
+            return reinterpret_cast<const uint8_t*>(structPtr)[offset] & (1u << bit);
+        }
+
+        void setBit(void* structPtr, bool value) const
+        {
+            auto& byte = reinterpret_cast<uint8_t*>(structPtr)[offset];
+            byte = static_cast<uint8_t>(value ? byte | (1u << bit) : byte & ~(1u << bit));
+        }
     };
 
+    // Sorted by offset
     const std::vector<Field>& getFields() const;
 
     size_t getSize() const;
 
     size_t getAlignment() const;
 
+    // Trivial structs (no strings, vectors, etc.) don't need init, free or copy at all
+    bool isTrivial() const;
+
+    // ptr has to point to zeroed memory (all pools and archetypes hand out zeroed memory)
     void init(void* ptr) const;
     void free(void* ptr) const;
+    // Copy-constructs src into the uninitialized memory at dst. Everything is memcpy'd and
+    // only the non-trivial fields (strings, vectors) are copied with FieldType::copy.
+    void copy(void* dst, const void* src) const;
 
 private:
+    /*
+     * init/free/copy used to call the virtual FieldType functions for every field (and every
+     * array element). Instead the struct is "compiled" once: The prototype is an initialized
+     * instance that init copies, and the ops are a flat list of all the non-trivial fields
+     * (arrays are unrolled), so free and copy only touch what they have to.
+     */
+    struct Op {
+        enum Kind : uint8_t { String, Vector, Other } kind;
+        uint32_t offset;
+        const FieldType* type;
+    };
+
     Struct(const std::vector<Field>& fields, size_t size, size_t alignment);
 
-    static void freeField(std::shared_ptr<FieldType> fieldType, uint8_t* ptr);
-    static void initField(std::shared_ptr<FieldType> fieldType, uint8_t* ptr);
+    void compile(const FieldType& type, size_t offset);
 
     std::vector<Field> fields_;
     size_t size_;
     size_t alignment_;
+    std::vector<uint8_t> prototype_;
+    std::vector<Op> initOps_; // everything the prototype can't do
+    std::vector<Op> ops_;
 };
 
-constexpr size_t padding(size_t offset, size_t alignment);
+constexpr size_t padding(size_t offset, size_t alignment)
+{
+    const auto misalignment = offset % alignment;
+    return misalignment > 0 ? alignment - misalignment : 0;
+}
 
-constexpr size_t align(size_t offset, size_t alignment);
+constexpr size_t align(size_t offset, size_t alignment)
+{
+    return offset + padding(offset, alignment);
+}
 
 class StructBuilder {
 public:
+    /*
+     * Structs that have to match a C++ type need Packing::None (the default), which lays out
+     * the fields in order like a C++ compiler would. For everything else the fields can be
+     * sorted by alignment (largest first), so there is no padding between them.
+     * Packing::Bits also packs all bools into bits at the end of the struct (like C bitfields).
+     */
+    enum class Packing { None, Reorder, Bits };
+
     StructBuilder();
 
+    void setPacking(Packing packing);
+
     void addField(const std::string& name, std::shared_ptr<FieldType> type);
 
     template <typename T>
@@ -78,7 +133,7 @@ public:
 
 private:
     std::vector<Struct::Field> fields_;
-    size_t currentOffset_;
+    Packing packing_;
 };
 
 template <>
@@ -123,4 +178,10 @@ inline void StructBuilder::addField<String>(const std::string& name)
     addField(name, std::make_shared<StringFieldType>());
 }
 
+template <>
+inline void StructBuilder::addField<Atom>(const std::string& name)
+{
+    addField(name, std::make_shared<AtomFieldType>());
+}
+
 }
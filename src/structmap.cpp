@@ -0,0 +1,406 @@
+#include "structmap.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <cstdlib>
+#include <cstring>
+
+#include "allocator.hpp"
+#include "atom.hpp"
+#include "fieldtype.hpp"
+#include "struct.hpp"
+#include "util.hpp"
+
+namespace myl {
+
+namespace {
+    constexpr uint8_t ctrlEmpty = 0x80;
+    constexpr uint8_t ctrlDeleted = 0xfe;
+    // Full slots have the low 7 bits of the hash, so the high bit is never set
+
+    constexpr uint64_t lsbs = 0x0101010101010101ull;
+    constexpr uint64_t msbs = 0x8080808080808080ull;
+
+    // The slots are in the same allocation, right after the control bytes
+    constexpr size_t slotsAlignment = 16;
+
+    uint64_t hashBytes(std::string_view bytes)
+    {
+        // FNV-1a and a Murmur3 finalizer, so both the low bits (the probe start) and the
+        // 7 bits in the control bytes are good
+        uint64_t hash = 14695981039346656037ull;
+        for (const auto c : bytes) {
+            hash ^= static_cast<uint8_t>(c);
+            hash *= 1099511628211ull;
+        }
+        hash ^= hash >> 33;
+        hash *= 0xff51afd7ed558ccdull;
+        hash ^= hash >> 33;
+        return hash;
+    }
+
+    uint8_t getH2(uint64_t hash)
+    {
+        return static_cast<uint8_t>(hash & 0x7f);
+    }
+
+    size_t getH1(uint64_t hash)
+    {
+        return static_cast<size_t>(hash >> 7);
+    }
+
+    /*
+     * A group of 8 control bytes is handled as one uint64_t (SWAR). The match functions return
+     * the high bit of every matching byte, so the index is countTrailingZeros / 8 (this assumes
+     * little endian). matchH2 might have false positives, but only for full slots next to a real
+     * match, and the keys are compared anyway.
+     */
+    uint64_t loadGroup(const uint8_t* ctrl)
+    {
+        uint64_t group;
+        std::memcpy(&group, ctrl, sizeof(group));
+        return group;
+    }
+
+    uint64_t matchH2(uint64_t group, uint8_t h2)
+    {
+        const auto x = group ^ (lsbs * h2);
+        return (x - lsbs) & ~x & msbs;
+    }
+
+    uint64_t matchEmpty(uint64_t group)
+    {
+        // Empty has the high bit set and bit 1 not (deleted has both)
+        return group & (~group << 6) & msbs;
+    }
+
+    uint64_t matchEmptyOrDeleted(uint64_t group)
+    {
+        return group & msbs;
+    }
+
+    size_t getAllocSize(size_t capacity, size_t slotSize)
+    {
+        return align(capacity, slotsAlignment) + capacity * slotSize;
+    }
+
+    // The smallest capacity that fits count entries with a max load of 7/8
+    size_t getCapacityFor(size_t count)
+    {
+        size_t capacity = Map::groupSize;
+        while (capacity - capacity / 8 < count)
+            capacity *= 2;
+        return capacity;
+    }
+}
+
+Map::Map(const MapFieldType* type)
+    : type_(type)
+{
+    assert(type_->keyType->getSize() > 0);
+    const auto keyAlign = type_->keyType->getAlignment();
+    const auto valueAlign = std::max<size_t>(type_->valueType->getAlignment(), 1);
+    assert(std::max(keyAlign, valueAlign) <= slotsAlignment);
+    const auto valueOffset = align(type_->keyType->getSize(), valueAlign);
+    const auto slotSize
+        = align(valueOffset + type_->valueType->getSize(), std::max(keyAlign, valueAlign));
+    assert(slotSize <= UINT32_MAX);
+    valueOffset_ = static_cast<uint32_t>(valueOffset);
+    slotSize_ = static_cast<uint32_t>(slotSize);
+}
+
+Map::Map(const Map& other)
+    : Map(other.type_)
+{
+    if (other.capacity_ == 0)
+        return;
+    allocate(other.capacity_);
+    std::memcpy(ctrl_, other.ctrl_, capacity_);
+    size_ = other.size_;
+    growthLeft_ = other.growthLeft_;
+    if (type_->keyType->isTrivial() && type_->valueType->isTrivial()) {
+        std::memcpy(slots_, other.slots_, capacity_ * slotSize_);
+        return;
+    }
+    for (size_t i = 0; i < capacity_; ++i) {
+        if (ctrl_[i] >= ctrlEmpty)
+            continue;
+        type_->keyType->copy(getKey(i), other.getKey(i));
+        type_->valueType->copy(getValue(i), other.getValue(i));
+    }
+}
+
+Map::~Map()
+{
+    freeEntries();
+    deallocate();
+}
+
+std::optional<std::string_view> Map::makeKey(double number, uint64_t& buffer) const
+{
+    const auto& keyType = *type_->keyType;
+    const auto store = [&buffer](auto value) {
+        static_assert(sizeof(value) <= sizeof(buffer));
+        std::memcpy(&buffer, &value, sizeof(value));
+        return std::string_view(reinterpret_cast<const char*>(&buffer), sizeof(value));
+    };
+    if (keyType.fieldType == FieldType::Enum)
+        return store(static_cast<int>(number));
+    if (keyType.fieldType != FieldType::Builtin)
+        return std::nullopt;
+    switch (dynamic_cast<const PrimitiveFieldType&>(keyType).type) {
+    case PrimitiveFieldType::Bool:
+        return store(number != 0.0);
+    case PrimitiveFieldType::U8:
+        return store(static_cast<uint8_t>(number));
+    case PrimitiveFieldType::I8:
+        return store(static_cast<int8_t>(number));
+    case PrimitiveFieldType::U16:
+        return store(static_cast<uint16_t>(number));
+    case PrimitiveFieldType::I16:
+        return store(static_cast<int16_t>(number));
+    case PrimitiveFieldType::U32:
+        return store(static_cast<uint32_t>(number));
+    case PrimitiveFieldType::I32:
+        return store(static_cast<int32_t>(number));
+    case PrimitiveFieldType::U64:
+        return store(static_cast<uint64_t>(number));
+    case PrimitiveFieldType::I64:
+        return store(static_cast<int64_t>(number));
+    default: // not a valid key type (see MapFieldType::isValidKeyType)
+        return std::nullopt;
+    }
+}
+
+std::optional<std::string_view> Map::makeKey(std::string_view str, uint64_t& buffer) const
+{
+    switch (type_->keyType->fieldType) {
+    case FieldType::String:
+        return str;
+    case FieldType::Atom: {
+        const auto id = Atom(str).getId();
+        std::memcpy(&buffer, &id, sizeof(id));
+        return std::string_view(reinterpret_cast<const char*>(&buffer), sizeof(id));
+    }
+    default: {
+        // TOML keys are always strings, so bool keys are written as true/false there
+        if (str == "true" || str == "false")
+            return makeKey(str == "true" ? 1.0 : 0.0, buffer);
+        const auto s = std::string(str);
+        char* end = nullptr;
+        const auto number = std::strtod(s.c_str(), &end);
+        if (s.empty() || *end != '\0')
+            return std::nullopt;
+        return makeKey(number, buffer);
+    }
+    }
+}
+
+void* Map::find(std::string_view key)
+{
+    return const_cast<void*>(static_cast<const Map*>(this)->find(key));
+}
+
+const void* Map::find(std::string_view key) const
+{
+    if (size_ == 0)
+        return nullptr;
+    const auto slot = findSlot(key, hashBytes(key));
+    return slot < capacity_ ? getValue(slot) : nullptr;
+}
+
+void* Map::insert(std::string_view key)
+{
+    const auto hash = hashBytes(key);
+    if (size_ > 0) {
+        const auto slot = findSlot(key, hash);
+        if (slot < capacity_)
+            return getValue(slot);
+    }
+
+    if (growthLeft_ == 0) {
+        // If it's mostly tombstones, a rehash with the same capacity is enough
+        const auto full = capacity_ > 0 && size_ >= (capacity_ - capacity_ / 8) / 2;
+        rehash(capacity_ == 0 ? groupSize : (full ? capacity_ * 2 : capacity_));
+    }
+    const auto slot = findInsertSlot(hash);
+    if (ctrl_[slot] == ctrlEmpty)
+        growthLeft_--;
+    ctrl_[slot] = getH2(hash);
+    size_++;
+
+    if (type_->keyType->fieldType == FieldType::String) {
+        new (getKey(slot)) String(key.data(), key.size());
+    } else {
+        assert(key.size() == type_->keyType->getSize());
+        std::memcpy(getKey(slot), key.data(), key.size());
+    }
+    const auto value = getValue(slot);
+    std::memset(value, 0, type_->valueType->getSize());
+    type_->valueType->init(value);
+    return value;
+}
+
+bool Map::erase(std::string_view key)
+{
+    if (size_ == 0)
+        return false;
+    const auto slot = findSlot(key, hashBytes(key));
+    if (slot == capacity_)
+        return false;
+    type_->keyType->free(getKey(slot));
+    type_->valueType->free(getValue(slot));
+    size_--;
+    // If the group still has an empty slot, no probe sequence ever continued past it (groups
+    // don't get new empty slots once they were full), so the slot can just be empty again.
+    const auto group = slot & ~(groupSize - 1);
+    if (matchEmpty(loadGroup(ctrl_ + group))) {
+        ctrl_[slot] = ctrlEmpty;
+        growthLeft_++;
+    } else {
+        ctrl_[slot] = ctrlDeleted;
+    }
+    return true;
+}
+
+void Map::clear()
+{
+    if (capacity_ == 0)
+        return;
+    freeEntries();
+    std::memset(ctrl_, ctrlEmpty, capacity_);
+    size_ = 0;
+    growthLeft_ = capacity_ - capacity_ / 8;
+}
+
+void Map::reserve(size_t count)
+{
+    const auto capacity = getCapacityFor(count);
+    if (capacity > capacity_)
+        rehash(capacity);
+}
+
+size_t Map::getSize() const
+{
+    return size_;
+}
+
+size_t Map::getCapacity() const
+{
+    return capacity_;
+}
+
+const MapFieldType* Map::getType() const
+{
+    return type_;
+}
+
+void* Map::getKey(size_t slot) const
+{
+    return slots_ + slot * slotSize_;
+}
+
+void* Map::getValue(size_t slot) const
+{
+    return slots_ + slot * slotSize_ + valueOffset_;
+}
+
+std::string_view Map::getKeyBytes(const void* key) const
+{
+    if (type_->keyType->fieldType == FieldType::String) {
+        const auto str = reinterpret_cast<const String*>(key);
+        return std::string_view(str->getData(), str->getSize());
+    }
+    return std::string_view(reinterpret_cast<const char*>(key), type_->keyType->getSize());
+}
+
+size_t Map::findSlot(std::string_view key, uint64_t hash) const
+{
+    // Triangular probing over the groups visits every group, because groupCount is a power of 2
+    const auto groupMask = capacity_ / groupSize - 1;
+    const auto h2 = getH2(hash);
+    auto group = getH1(hash) & groupMask;
+    for (size_t i = 1;; ++i) {
+        const auto ctrl = loadGroup(ctrl_ + group * groupSize);
+        for (auto bits = matchH2(ctrl, h2); bits; bits &= bits - 1) {
+            const auto slot = group * groupSize + countTrailingZeros(bits) / 8;
+            if (getKeyBytes(getKey(slot)) == key)
+                return slot;
+        }
+        // There is always at least one empty slot (max load is 7/8)
+        if (matchEmpty(ctrl))
+            return capacity_;
+        group = (group + i) & groupMask;
+    }
+}
+
+size_t Map::findInsertSlot(uint64_t hash) const
+{
+    const auto groupMask = capacity_ / groupSize - 1;
+    auto group = getH1(hash) & groupMask;
+    for (size_t i = 1;; ++i) {
+        const auto bits = matchEmptyOrDeleted(loadGroup(ctrl_ + group * groupSize));
+        if (bits)
+            return group * groupSize + countTrailingZeros(bits) / 8;
+        group = (group + i) & groupMask;
+    }
+}
+
+void Map::allocate(size_t capacity)
+{
+    assert(capacity >= groupSize && (capacity & (capacity - 1)) == 0);
+    assert(capacity <= UINT32_MAX);
+    const auto data = reinterpret_cast<uint8_t*>(
+        getFieldAllocator().allocate(getAllocSize(capacity, slotSize_)));
+    ctrl_ = data;
+    slots_ = data + align(capacity, slotsAlignment);
+    capacity_ = static_cast<uint32_t>(capacity);
+    std::memset(ctrl_, ctrlEmpty, capacity_);
+    growthLeft_ = capacity_ - capacity_ / 8;
+}
+
+void Map::deallocate()
+{
+    if (ctrl_)
+        getFieldAllocator().deallocate(ctrl_, getAllocSize(capacity_, slotSize_));
+    ctrl_ = nullptr;
+    slots_ = nullptr;
+    capacity_ = 0;
+}
+
+void Map::freeEntries()
+{
+    if (type_->keyType->isTrivial() && type_->valueType->isTrivial())
+        return;
+    for (size_t i = 0; i < capacity_; ++i) {
+        if (ctrl_[i] >= ctrlEmpty)
+            continue;
+        type_->keyType->free(getKey(i));
+        type_->valueType->free(getValue(i));
+    }
+}
+
+void Map::rehash(size_t capacity)
+{
+    assert(capacity - capacity / 8 > size_);
+    const auto oldCtrl = ctrl_;
+    const auto oldSlots = slots_;
+    const auto oldCapacity = capacity_;
+    ctrl_ = nullptr;
+    allocate(capacity);
+    // Keys and values are moved with memcpy (like components)
+    for (size_t i = 0; i < oldCapacity; ++i) {
+        if (oldCtrl[i] >= ctrlEmpty)
+            continue;
+        const auto oldSlot = oldSlots + i * slotSize_;
+        const auto hash = hashBytes(getKeyBytes(oldSlot));
+        const auto slot = findInsertSlot(hash);
+        ctrl_[slot] = getH2(hash);
+        std::memcpy(getKey(slot), oldSlot, slotSize_);
+    }
+    growthLeft_ -= size_;
+    if (oldCtrl)
+        getFieldAllocator().deallocate(oldCtrl, getAllocSize(oldCapacity, slotSize_));
+}
+
+}
@@ -0,0 +1,95 @@
+#pragma once
+
+#include <cstdint>
+#include <optional>
+#include <string_view>
+#include <type_traits>
+
+namespace myl {
+
+struct MapFieldType;
+
+/*
+ * A flat hash map with open addressing (like Abseil's SwissTable). Every slot has a control byte,
+ * which is empty, deleted or the low 7 bits of the hash of its key, so a lookup compares a whole
+ * group of 8 control bytes at once and only looks at the keys whose 7 bits match.
+ * A slot is the key followed by the value (described by MapFieldType::keyType and valueType).
+ * Keys are passed as bytes: the characters for string keys and the object representation (see
+ * key) for everything else.
+ * Like Vector this doesn't point into itself, so it can be moved with memcpy, and the memory
+ * comes from getFieldAllocator().
+ * The layout is shared with the MylMap cdef in lua/map.lua - keep them in sync!
+ */
+class Map {
+public:
+    static constexpr size_t groupSize = 8;
+
+    Map(const MapFieldType* type);
+    // Copies every entry with FieldType::copy
+    Map(const Map& other);
+    Map& operator=(const Map&) = delete;
+    ~Map();
+
+    template <typename T>
+    static std::string_view key(const T& value)
+    {
+        static_assert(std::is_trivially_copyable_v<T>);
+        return std::string_view(reinterpret_cast<const char*>(&value), sizeof(T));
+    }
+
+    /*
+     * For Lua and prefab files, which only have numbers and strings: Numbers are converted to
+     * the key type and strings are interned for atom keys or parsed for number keys.
+     * buffer is where the converted key lives, so it has to outlive the returned key.
+     */
+    std::optional<std::string_view> makeKey(double number, uint64_t& buffer) const;
+    std::optional<std::string_view> makeKey(std::string_view str, uint64_t& buffer) const;
+
+    // nullptr if there is no such key
+    void* find(std::string_view key);
+    const void* find(std::string_view key) const;
+    // Returns the value, which is newly initialized if the key wasn't in the map yet
+    void* insert(std::string_view key);
+    bool erase(std::string_view key);
+    void clear();
+    void reserve(size_t count);
+
+    size_t getSize() const;
+    size_t getCapacity() const;
+    const MapFieldType* getType() const;
+
+    // func(const void* key, void* value). String keys are myl::Strings.
+    template <typename Func>
+    void forEach(Func&& func)
+    {
+        for (size_t i = 0; i < capacity_; ++i) {
+            if (ctrl_[i] < 0x80)
+                func(getKey(i), getValue(i));
+        }
+    }
+
+private:
+    void* getKey(size_t slot) const;
+    void* getValue(size_t slot) const;
+    std::string_view getKeyBytes(const void* key) const;
+    // The slot with that key or capacity_ if there is none
+    size_t findSlot(std::string_view key, uint64_t hash) const;
+    // The first empty or deleted slot in the probe sequence
+    size_t findInsertSlot(uint64_t hash) const;
+    void allocate(size_t capacity);
+    void deallocate();
+    void freeEntries();
+    void rehash(size_t capacity);
+
+    uint8_t* ctrl_ = nullptr; // capacity_ bytes
+    uint8_t* slots_ = nullptr; // capacity_ * slotSize_ bytes (in the same allocation)
+    uint32_t size_ = 0;
+    uint32_t capacity_ = 0; // 0 or a power of two >= groupSize
+    // How many more empty slots can be filled before the map has to grow (max load is 7/8)
+    uint32_t growthLeft_ = 0;
+    uint32_t slotSize_ = 0;
+    uint32_t valueOffset_ = 0;
+    const MapFieldType* type_ = nullptr;
+};
+
+}
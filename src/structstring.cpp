@@ -1,11 +1,15 @@
 #include "structstring.hpp"
 
+#include <algorithm>
 #include <cassert>
+#include <cstddef>
+
+#include "allocator.hpp"
 
 namespace myl {
 String::String()
 {
-    assign(nullptr, 0); // to preallocate minAllocSize
+    static_assert(offsetof(String, tag_) == inlineCapacity);
 }
 
 String::String(const char* buf, size_t size)
@@ -23,22 +27,42 @@ String::String(const std::string& str)
 {
 }
 
+String::String(const String& str)
+    : String(str.getData(), str.getSize())
+{
+}
+
 String::~String()
 {
-    std::free(data_);
+    if (!isInline())
+        getFieldAllocator().deallocate(data_, capacity_);
 }
 
 void String::assign(const char* buf, size_t size)
 {
-    if (capacity_ < size + 1) {
-        std::free(data_);
-        const auto allocSize = std::max(minAllocSize, std::max(capacity_ * 2, size + 1));
-        data_ = reinterpret_cast<char*>(std::malloc(allocSize));
-        capacity_ = allocSize;
+    // buf might point into this string, so use memmove and don't free before copying
+    if (isInline() && size < inlineCapacity) {
+        if (buf)
+            std::memmove(getInlineData(), buf, size);
+        getInlineData()[size] = '\0';
+        tag_ = static_cast<uint8_t>(size);
+        return;
+    }
+
+    if (getCapacity() < size + 1) {
+        const auto allocSize = std::max(minAllocSize, std::max(getCapacity() * 2, size + 1));
+        assert(allocSize <= UINT32_MAX);
+        const auto data = reinterpret_cast<char*>(getFieldAllocator().allocate(allocSize));
+        if (buf)
+            std::memcpy(data, buf, size);
+        if (!isInline())
+            getFieldAllocator().deallocate(data_, capacity_);
+        data_ = data;
+        capacity_ = static_cast<uint32_t>(allocSize);
+        tag_ = heapTag;
+    } else if (buf) {
+        std::memmove(data_, buf, size);
     }
-    assert(data_);
-    if (buf)
-        std::memcpy(data_, buf, size);
     data_[size] = '\0';
     size_ = size;
 }
@@ -78,7 +102,7 @@ String& String::operator=(const std::string& str)
 
 std::string String::str() const
 {
-    return std::string(data_, size_);
+    return std::string(getData(), getSize());
 }
 
 String::operator std::string() const
@@ -88,16 +112,31 @@ String::operator std::string() const
 
 const char* String::getData() const
 {
-    return data_;
+    return isInline() ? getInlineData() : data_;
 }
 
 size_t String::getSize() const
 {
-    return size_;
+    return isInline() ? tag_ : size_;
 }
 
 size_t String::getCapacity() const
 {
-    return capacity_;
+    return isInline() ? inlineCapacity : capacity_;
+}
+
+bool String::isInline() const
+{
+    return tag_ != heapTag;
+}
+
+char* String::getInlineData()
+{
+    return reinterpret_cast<char*>(this);
+}
+
+const char* String::getInlineData() const
+{
+    return reinterpret_cast<const char*>(this);
 }
 }
@@ -1,19 +1,30 @@
 #pragma once
 
+#include <cstdint>
 #include <cstdlib>
 #include <cstring>
 #include <string>
 
 namespace myl {
 
+/* Strings shorter than inlineCapacity are stored inside the object itself (small-string
+ * optimization). The last byte is a tag: for inline strings it's the size, for heap strings it's
+ * heapTag. This means that zeroed memory is a valid empty string and a default constructed string
+ * doesn't allocate. Longer strings are allocated with getFieldAllocator().
+ * The layout is shared with the MylString cdef in lua/string.lua - keep them in sync!
+ */
 class String {
     static constexpr size_t minAllocSize = 32;
+    static constexpr uint8_t heapTag = 0xff;
 
 public:
+    static constexpr size_t inlineCapacity = 23; // counts '\0'
+
     String();
     String(const char* buf, size_t size);
     String(const char* str);
     String(const std::string& str);
+    String(const String& str);
     ~String();
 
     void assign(const char* buf, size_t size);
@@ -31,11 +42,20 @@ public:
     const char* getData() const;
     size_t getSize() const;
     size_t getCapacity() const;
+    bool isInline() const;
 
 private:
+    char* getInlineData();
+    const char* getInlineData() const;
+
+    // Only valid if tag_ == heapTag. Otherwise all bytes before tag_ are the inline buffer.
     char* data_ = nullptr;
     size_t size_ = 0; // in characters
-    size_t capacity_ = 0; // (counts '\0' - the size of the buffer pointed to by data)
+    uint32_t capacity_ = 0; // (counts '\0' - the size of the buffer pointed to by data)
+    uint8_t padding_[3] = {};
+    uint8_t tag_ = 0;
 };
 
+static_assert(sizeof(String) == 24);
+
 }
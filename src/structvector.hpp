@@ -1,28 +1,57 @@
 #pragma once
 
+#include <algorithm>
 #include <cstdint>
-#include <cstdlib>
+#include <cstring>
 
+#include "allocator.hpp"
 #include "fieldtype.hpp"
 
 namespace myl {
 
+/* Elements that fit into inlineSize bytes are stored in the vector itself (in place of the data
+ * pointer), so short vectors don't allocate. Everything else comes from getFieldAllocator().
+ * Vectors don't point into themselves, so they can still be moved with memcpy.
+ */
 class Vector {
 public:
+    static constexpr size_t inlineSize = 16;
+
     Vector(FieldType* elementType)
         : elementType_(elementType)
     {
     }
 
+    // Copies every element with FieldType::copy
+    Vector(const Vector& other)
+        : elementType_(other.elementType_)
+    {
+        resize_(other.size_);
+        if (elementType_->isTrivial()) {
+            std::memcpy(getData(), other.getData(), size_ * elementType_->getSize());
+            return;
+        }
+        for (size_t i = 0; i < size_; ++i)
+            elementType_->copy(getPointer(i), other.getPointer(i));
+    }
+
+    Vector& operator=(const Vector&) = delete;
+
     ~Vector()
     {
         resize(0);
-        std::free(data_);
+        if (!isInline())
+            getFieldAllocator().deallocate(data_, capacity_ * elementType_->getSize());
     }
 
     void* getPointer(size_t index)
     {
-        return data_ + index * elementType_->getSize();
+        return getData<uint8_t>() + index * elementType_->getSize();
+    }
+
+    const void* getPointer(size_t index) const
+    {
+        return getData<uint8_t>() + index * elementType_->getSize();
     }
 
     template <typename T>
@@ -68,7 +97,13 @@ public:
     template <typename T = void>
     T* getData()
     {
-        return data_;
+        return reinterpret_cast<T*>(isInline() ? inline_ : data_);
+    }
+
+    template <typename T = void>
+    const T* getData() const
+    {
+        return reinterpret_cast<const T*>(isInline() ? inline_ : data_);
     }
 
     size_t getSize() const
@@ -86,21 +121,36 @@ public:
         return elementType_->getSize();
     }
 
+    bool isInline() const
+    {
+        return capacity_ * elementType_->getSize() <= inlineSize;
+    }
+
 private:
     void resize_(size_t newSize)
     {
         if (capacity_ < newSize) {
-            const auto oldData = data_;
+            const auto elemSize = elementType_->getSize();
             const auto newCap = std::max(size_ * 2, newSize);
-            data_ = reinterpret_cast<uint8_t*>(std::malloc(newCap * elementType_->getSize()));
-            capacity_ = newCap;
-            std::memcpy(data_, oldData, size_ * elementType_->getSize());
-            std::free(oldData);
+            if (newCap * elemSize <= inlineSize) {
+                capacity_ = newCap;
+            } else {
+                const auto data
+                    = reinterpret_cast<uint8_t*>(getFieldAllocator().allocate(newCap * elemSize));
+                std::memcpy(data, getData(), size_ * elemSize);
+                if (!isInline())
+                    getFieldAllocator().deallocate(data_, capacity_ * elemSize);
+                data_ = data;
+                capacity_ = newCap;
+            }
         }
         size_ = newSize;
     }
 
-    uint8_t* data_ = nullptr;
+    union {
+        uint8_t* data_ = nullptr; // if !isInline()
+        uint8_t inline_[inlineSize];
+    };
     size_t size_ = 0;
     size_t capacity_ = 0;
     // Yes, this should be a std::shared_ptr<FieldType>, but I want to share this struct
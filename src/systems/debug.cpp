@@ -162,6 +162,21 @@ void DebugSystem::showSystemInspector()
     }
     ImGui::Separator();
 
+    // Timeline of the last invokeSystems
+    {
+        const auto& timeline = myl::getTimeline();
+        if (!timeline.empty() && ImGui::TreeNode("Timeline")) {
+            const auto start = timeline.front().start;
+            for (const auto& entry : timeline) {
+                ImGui::Text("Thread %zu: %s (%.3f ms - %.3f ms)", entry.thread,
+                    systems[entry.system].name.c_str(), (entry.start - start) * 1000.0,
+                    (entry.end - start) * 1000.0);
+            }
+            ImGui::TreePop();
+        }
+    }
+    ImGui::Separator();
+
     // Plots
     {
         if (ImGui::Button("Clear Graphs")) {
@@ -199,8 +214,6 @@ void DebugSystem::showEntityInspector()
 {
     static auto selectedEntity = myl::maxId<myl::EntityId>();
 
-    const auto entities = myl::getEntities();
-
     const ImGuiIO& io = ImGui::GetIO();
     const size_t width = 500;
     ImGui::SetNextWindowSize(
@@ -216,7 +229,7 @@ void DebugSystem::showEntityInspector()
             myl::newEntity();
         ImGui::Separator();
 
-        for (auto entity : entities) {
+        for (const auto entity : myl::foreachEntity()) {
             if (ImGui::Selectable(getEntityName(entity).c_str(), selectedEntity == entity))
                 selectedEntity = entity;
         }
@@ -231,7 +244,8 @@ void DebugSystem::showEntityInspector()
         const auto& components = myl::getComponents();
         ImGui::BeginChild("entity view", ImVec2(0, 0), true);
 
-        ImGui::Text("ID: %zu", static_cast<size_t>(selectedEntity));
+        ImGui::Text("ID: %zu (generation %u)", myl::getIndex(selectedEntity),
+            myl::getGeneration(selectedEntity));
 
         ImGui::Separator();
 
@@ -253,7 +267,7 @@ void DebugSystem::showEntityInspector()
                         continue;
                     }
                     ImGui::Separator();
-                    showComponentElements(component, ptr);
+                    showComponentElements(component, entity);
                 }
             } else {
                 addOptions.push_back(name.c_str());
@@ -427,6 +441,13 @@ void DebugSystem::showFieldElement(
         reinterpret_cast<myl::String*>(ptr)->assign(text);
         break;
     }
+    case myl::FieldType::Atom: {
+        // Only intern on enter, otherwise every keystroke would add an atom
+        std::string text = reinterpret_cast<myl::Atom*>(ptr)->str();
+        if (ImGui::InputText(name.c_str(), &text, ImGuiInputTextFlags_EnterReturnsTrue))
+            *reinterpret_cast<myl::Atom*>(ptr) = myl::Atom(text);
+        break;
+    }
     case myl::FieldType::Array: {
         auto ft = std::dynamic_pointer_cast<myl::ArrayFieldType>(fieldType);
         if (ImGui::TreeNode(name.c_str())) {
@@ -457,15 +478,43 @@ void DebugSystem::showFieldElement(
         }
         break;
     }
+    case myl::FieldType::Map: {
+        auto ft = std::dynamic_pointer_cast<myl::MapFieldType>(fieldType);
+        if (ImGui::TreeNode(name.c_str())) {
+            auto& map = *reinterpret_cast<myl::Map*>(ptr);
+            map.forEach([&ft](const void* key, void* value) {
+                std::string label;
+                if (ft->keyType->fieldType == myl::FieldType::String)
+                    label = reinterpret_cast<const myl::String*>(key)->str();
+                else if (ft->keyType->fieldType == myl::FieldType::Atom)
+                    label = reinterpret_cast<const myl::Atom*>(key)->str();
+                else
+                    label = myl::hexString(key, ft->keyType->getSize());
+                showFieldElement(label, ft->valueType, value);
+            });
+            ImGui::TreePop();
+        }
+        break;
+    }
     default:
         ImGui::Text("Unimplemented Field Type");
     }
 }
 
-void DebugSystem::showComponentElements(const myl::Component& component, void* ptr)
+void DebugSystem::showComponentElements(const myl::Component& component, myl::EntityId entity)
 {
-    for (const auto& field : component.getStruct().getFields()) {
-        auto fieldPtr = reinterpret_cast<uint8_t*>(ptr) + field.offset;
-        showFieldElement(field.name, field.type, fieldPtr);
+    const auto compId = component.getId();
+    const auto& fields = component.getStruct().getFields();
+    for (size_t i = 0; i < fields.size(); ++i) {
+        const auto& field = fields[i];
+        if (field.bit >= 0) {
+            const auto ptr = myl::getComponentBuffer(entity, compId);
+            bool value = field.getBit(ptr);
+            if (ImGui::Checkbox(field.name.c_str(), &value))
+                field.setBit(ptr, value);
+            continue;
+        }
+        // SoA components don't have a struct pointer, so go through the fields
+        showFieldElement(field.name, field.type, myl::getFieldBuffer(entity, compId, i));
     }
 }
@@ -28,7 +28,7 @@ private:
     static std::string getComponentCaption(const myl::Component& component, const void* ptr);
     static void showFieldElement(
         const std::string& name, std::shared_ptr<myl::FieldType> fieldType, void* ptr);
-    static void showComponentElements(const myl::Component& component, void* ptr);
+    static void showComponentElements(const myl::Component& component, myl::EntityId entity);
 
     bool showEntityInspector_ = false;
     bool showSystemInspector_ = false;
@@ -20,9 +20,8 @@ void RectangleRenderSystem::update(float /*dt*/)
     static const auto cRectangle = myl::getComponentId("RectangleRender");
     static const auto cColor = myl::getComponentId("Color");
     auto& batch = getBatch();
-    for (auto entity : myl::getEntities(cTransform + cRectangle)) {
-        const auto trafo = myl::getComponent<c::Transform>(entity, cTransform);
-        const auto rect = myl::getComponent<c::RectangleRender>(entity, cRectangle);
+    for (const auto [entity, trafo, rect] :
+        myl::view<c::Transform, c::RectangleRender>(cTransform, cRectangle)) {
         const auto color = myl::hasComponent(entity, cColor)
             ? static_cast<glm::vec4>(myl::getComponent<c::Color>(entity, cColor)->value)
             : glm::vec4(1.0f);
@@ -37,9 +36,8 @@ void CircleRenderSystem::update(float /*dt*/)
     static const auto cCircle = myl::getComponentId("CircleRender");
     static const auto cColor = myl::getComponentId("Color");
     auto& batch = getBatch();
-    for (auto entity : myl::getEntities(cTransform + cCircle)) {
-        const auto trafo = myl::getComponent<c::Transform>(entity, cTransform);
-        const auto circle = myl::getComponent<c::CircleRender>(entity, cCircle);
+    for (const auto [entity, trafo, circle] :
+        myl::view<c::Transform, c::CircleRender>(cTransform, cCircle)) {
         const auto color = myl::hasComponent(entity, cColor)
             ? static_cast<glm::vec4>(myl::getComponent<c::Color>(entity, cColor)->value)
             : glm::vec4(1.0f);
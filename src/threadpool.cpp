@@ -0,0 +1,162 @@
+#include "threadpool.hpp"
+
+#include <algorithm>
+#include <memory>
+
+namespace myl {
+
+ThreadPool::ThreadPool(size_t threadCount)
+{
+    if (threadCount == 0) {
+        const size_t hardwareThreads = std::thread::hardware_concurrency();
+        threadCount = std::max(hardwareThreads, size_t(2)) - 1;
+    }
+    for (size_t i = 0; i < threadCount; ++i)
+        threads_.emplace_back([this, i]() { work(i + 1); });
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stop_ = true;
+    }
+    condition_.notify_all();
+    for (auto& thread : threads_)
+        thread.join();
+}
+
+size_t ThreadPool::getThreadCount() const
+{
+    return threads_.size();
+}
+
+void ThreadPool::push(Task task)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        tasks_.push_back(std::move(task));
+    }
+    condition_.notify_one();
+}
+
+namespace {
+    thread_local size_t currentThreadIndex = 0;
+
+    struct ParallelFor {
+        struct Range {
+            std::mutex mutex;
+            size_t begin;
+            size_t end;
+        };
+
+        std::function<void(size_t, size_t)> func;
+        size_t count;
+        std::vector<Range> ranges;
+        std::atomic<size_t> done { 0 };
+        std::mutex mutex;
+        std::condition_variable condition;
+
+        ParallelFor(
+            size_t count, size_t rangeCount, const std::function<void(size_t, size_t)>& func)
+            : func(func)
+            , count(count)
+            , ranges(rangeCount)
+        {
+            for (size_t i = 0; i < rangeCount; ++i) {
+                ranges[i].begin = count * i / rangeCount;
+                ranges[i].end = count * (i + 1) / rangeCount;
+            }
+        }
+
+        bool pop(size_t range, size_t& index)
+        {
+            std::lock_guard<std::mutex> lock(ranges[range].mutex);
+            if (ranges[range].begin == ranges[range].end)
+                return false;
+            index = ranges[range].begin++;
+            return true;
+        }
+
+        // Moves the back half of the fullest other range into range
+        bool steal(size_t range)
+        {
+            size_t victim = range;
+            size_t victimSize = 0;
+            for (size_t i = 0; i < ranges.size(); ++i) {
+                // This is racy, but it's just a heuristic
+                std::lock_guard<std::mutex> lock(ranges[i].mutex);
+                const auto size = ranges[i].end - ranges[i].begin;
+                if (i != range && size > victimSize) {
+                    victim = i;
+                    victimSize = size;
+                }
+            }
+            if (victim == range)
+                return false;
+
+            std::scoped_lock lock(ranges[range].mutex, ranges[victim].mutex);
+            auto& v = ranges[victim];
+            if (v.begin == v.end)
+                return true; // try again
+            const auto mid = v.begin + (v.end - v.begin) / 2;
+            ranges[range].begin = mid;
+            ranges[range].end = v.end;
+            v.end = mid;
+            return true;
+        }
+
+        void run(size_t range, size_t thread)
+        {
+            size_t index = 0;
+            while (true) {
+                if (pop(range, index)) {
+                    func(index, thread);
+                    if (++done == count) {
+                        std::lock_guard<std::mutex> lock(mutex);
+                        condition.notify_all();
+                    }
+                } else if (!steal(range)) {
+                    return;
+                }
+            }
+        }
+    };
+}
+
+size_t ThreadPool::getCurrentThreadIndex()
+{
+    return currentThreadIndex;
+}
+
+void ThreadPool::parallelFor(size_t count, const std::function<void(size_t, size_t)>& func)
+{
+    if (count == 0)
+        return;
+    // The state is shared, because workers might only start after everything is done
+    const auto state = std::make_shared<ParallelFor>(count, threads_.size() + 1, func);
+    for (size_t i = 0; i < threads_.size(); ++i)
+        push([state, i](size_t thread) { state->run(i + 1, thread); });
+    state->run(0, getCurrentThreadIndex());
+    std::unique_lock<std::mutex> lock(state->mutex);
+    state->condition.wait(lock, [&state]() { return state->done == state->count; });
+}
+
+void ThreadPool::work(size_t index)
+{
+    currentThreadIndex = index;
+    while (true) {
+        Task task;
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            condition_.wait(lock, [this]() { return stop_ || !tasks_.empty(); });
+            if (stop_ && tasks_.empty())
+                return;
+            task = std::move(tasks_.front());
+            tasks_.pop_front();
+        }
+        task(index);
+    }
+}
+
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace myl {
+
+class ThreadPool {
+public:
+    // The task gets the index of the thread it runs on. Index 0 is reserved for the thread
+    // that owns the pool, so workers start at 1.
+    using Task = std::function<void(size_t)>;
+
+    // 0 means one less than the number of hardware threads (but at least 1)
+    ThreadPool(size_t threadCount = 0);
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    size_t getThreadCount() const;
+
+    // The index of the calling thread in the pool it belongs to or 0 if it's not a worker
+    static size_t getCurrentThreadIndex();
+
+    void push(Task task);
+
+    /*
+     * Calls func(index, thread) for every index in [0, count) and returns when all of them
+     * are done. Every thread (including the calling one) starts with an equal share of the
+     * indices and steals half of the remaining indices of another thread when it runs out.
+     * The calling thread does not wait for the workers to start, so this is also fine to
+     * call from inside a task.
+     */
+    void parallelFor(size_t count, const std::function<void(size_t, size_t)>& func);
+
+private:
+    void work(size_t index);
+
+    std::vector<std::thread> threads_;
+    std::mutex mutex_;
+    std::condition_variable condition_;
+    std::deque<Task> tasks_;
+    bool stop_ = false;
+};
+
+}
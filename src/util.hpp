@@ -1,8 +1,39 @@
 #pragma once
 
+#include <cstdint>
 #include <string>
 
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
 namespace myl {
 double getTime();
 std::string hexString(const void* data, size_t size);
+
+// value must not be 0
+inline size_t countTrailingZeros(uint64_t value)
+{
+#ifdef _MSC_VER
+    unsigned long index;
+    _BitScanForward64(&index, value);
+    return index;
+#else
+    return __builtin_ctzll(value);
+#endif
+}
+
+// Interleaves the bits of x and y, so points that are close in 2D are mostly close in 1D too
+inline uint64_t mortonCode(uint32_t x, uint32_t y)
+{
+    const auto spread = [](uint64_t v) {
+        v = (v | (v << 16)) & 0x0000FFFF0000FFFFull;
+        v = (v | (v << 8)) & 0x00FF00FF00FF00FFull;
+        v = (v | (v << 4)) & 0x0F0F0F0F0F0F0F0Full;
+        v = (v | (v << 2)) & 0x3333333333333333ull;
+        v = (v | (v << 1)) & 0x5555555555555555ull;
+        return v;
+    };
+    return spread(x) | (spread(y) << 1);
+}
 }